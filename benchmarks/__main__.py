@@ -0,0 +1,14 @@
+import sys
+
+# imported for their @benchmark registrations
+from benchmarks import (  # noqa: F401
+    bench_checkpoint,
+    bench_collector,
+    bench_sflow,
+    bench_translate,
+    bench_tsstore,
+)
+from benchmarks.harness import main
+
+if __name__ == "__main__":
+    sys.exit(main())
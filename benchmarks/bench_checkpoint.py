@@ -0,0 +1,78 @@
+"""Checkpoint write and restore of collector state.
+
+The state is what a pipeline holds after one polling round of a 50k
+interface fleet plus a window of aggregated flows. Items are table
+entries (interfaces + flows + agents).
+"""
+
+import os
+import shutil
+import tempfile
+
+from benchmarks.bench_sflow import _flow_samples
+from benchmarks.harness import Case, benchmark
+from ipfix_parser import pipeline, synth
+
+FLEET = synth.FleetMix(agents=1000, interfaces_per_agent=50)
+
+
+def _loaded_pipeline() -> pipeline.Pipeline:
+    p = pipeline.Pipeline(exporter=lambda window: None)
+    for _ts, agent, sample in synth.CounterFleet(FLEET).polls(1):
+        p._track_if_counters(agent, sample)
+    for i, agent in enumerate({agent for agent, _ in p.if_counters.items()}):
+        p.agent_sequences[agent] = i
+    p.aggregate_batch(p.dissect_batch(_flow_samples(synth.SflowMix())))
+    return p
+
+
+def _entries(p: pipeline.Pipeline) -> int:
+    return len(p.if_counters) + len(p._flows) + len(p.agent_sequences)
+
+
+@benchmark("checkpoint/write")
+def write() -> Case:
+    p = _loaded_pipeline()
+    tmp = tempfile.mkdtemp(prefix="checkpoint-")
+    path = os.path.join(tmp, "collector.ckp")
+    size = p.checkpoint(path)
+    return Case(
+        lambda: p.checkpoint(path),
+        items=_entries(p),
+        bytes=size,
+        teardown=lambda: shutil.rmtree(tmp),
+    )
+
+
+@benchmark("checkpoint/restore")
+def restore() -> Case:
+    p = _loaded_pipeline()
+    tmp = tempfile.mkdtemp(prefix="checkpoint-")
+    path = os.path.join(tmp, "collector.ckp")
+    size = p.checkpoint(path)
+
+    def run():
+        pipeline.Pipeline(exporter=lambda window: None).restore(path)
+
+    return Case(
+        run, items=_entries(p), bytes=size, teardown=lambda: shutil.rmtree(tmp)
+    )
+
+
+@benchmark("checkpoint/freeze_thaw")
+def freeze_thaw() -> Case:
+    """What the owning stage pays per checkpoint, with 1% of entries
+    touched while frozen."""
+    p = _loaded_pipeline()
+    table = p.if_counters
+    keys = [k for k, _ in table.items()][::100]
+
+    def run():
+        table.request_freeze()
+        table.poll()
+        for k in keys:
+            table[k] = table.get(k)
+        table.release()
+        table.poll()
+
+    return Case(run, items=1)
@@ -0,0 +1,50 @@
+"""IPFIX collector benchmarks over loopback."""
+
+import socket
+import threading
+
+from benchmarks.bench_sflow import CORPUS_SIZE
+from benchmarks.harness import Case, benchmark
+from ipfix_parser import collector, synth
+
+CONNECTIONS = 16
+
+
+@benchmark("collector/tcp_ingest_16_connections")
+def tcp_ingest() -> Case:
+    """Messages streamed on 16 exporter connections, framed and decoded."""
+    corpus = list(synth.IpfixGenerator().messages(CORPUS_SIZE))
+    stream = b"".join(corpus)
+    count = [0]
+
+    def sink(exporter, msg):
+        count[0] += 1
+        return True
+
+    col = collector.IpfixCollector(sink)
+    addr = col.listen_tcp("127.0.0.1", 0)
+    clients = [socket.create_connection(addr) for _ in range(CONNECTIONS)]
+    while col.metrics.connections_accepted < CONNECTIONS:
+        col.poll()
+
+    def run():
+        target = count[0] + CONNECTIONS * len(corpus)
+        senders = [threading.Thread(target=c.sendall, args=(stream,)) for c in clients]
+        for t in senders:
+            t.start()
+        while count[0] < target:
+            col.poll()
+        for t in senders:
+            t.join()
+
+    def teardown():
+        for c in clients:
+            c.close()
+        col.close()
+
+    return Case(
+        run,
+        items=CONNECTIONS * len(corpus),
+        bytes=CONNECTIONS * len(stream),
+        teardown=teardown,
+    )
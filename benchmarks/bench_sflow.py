@@ -0,0 +1,196 @@
+"""Decode, dissection, aggregation and ingest benchmarks."""
+
+import socket
+import threading
+import time
+
+from benchmarks.harness import Case, benchmark
+from ipfix_parser import dissect, ipfix, pipeline, replicator, sflow, synth
+
+CORPUS_SIZE = 1000
+
+
+def _corpus(mix: synth.SflowMix, count: int = CORPUS_SIZE):
+    return list(synth.SflowGenerator(mix).datagrams(count))
+
+
+def _decode_case(corpus) -> Case:
+    def run():
+        for data in corpus:
+            sflow.decode_datagram(data)
+
+    return Case(run, items=len(corpus), bytes=sum(len(d) for d in corpus))
+
+
+@benchmark("sflow/decode_datagram")
+def decode_datagram() -> Case:
+    return _decode_case(_corpus(synth.SflowMix()))
+
+
+@benchmark("sflow/decode_datagram_all_structures")
+def decode_datagram_all() -> Case:
+    return _decode_case(_corpus(synth.SflowMix.everything()))
+
+
+@benchmark("sflow/decode_header")
+def decode_header() -> Case:
+    corpus = _corpus(synth.SflowMix())
+
+    def run():
+        for data in corpus:
+            sflow.decode_header(data)
+
+    return Case(run, items=len(corpus))
+
+
+def _record_bounds(corpus, sample_format: int):
+    bounds = []
+    for data in corpus:
+        dgram = sflow.decode_header(data)
+        for fmt, start, end in sflow.iter_sample_bounds(data, dgram):
+            if fmt == sample_format:
+                for rec in sflow.iter_record_bounds(data, fmt, start, end):
+                    bounds.append((data,) + rec)
+    return bounds
+
+
+@benchmark("sflow/decode_flow_record")
+def decode_flow_record() -> Case:
+    bounds = _record_bounds(_corpus(synth.SflowMix.everything()), sflow.SAMPLE_FLOW)
+
+    def run():
+        for data, fmt, start, end in bounds:
+            sflow.decode_flow_record(fmt, data, start, end)
+
+    return Case(run, items=len(bounds))
+
+
+@benchmark("sflow/decode_counter_record")
+def decode_counter_record() -> Case:
+    corpus = _corpus(synth.SflowMix.everything())
+    bounds = _record_bounds(corpus, sflow.SAMPLE_COUNTERS)
+
+    def run():
+        for data, fmt, start, end in bounds:
+            sflow.decode_counter_record(fmt, data, start, end)
+
+    return Case(run, items=len(bounds))
+
+
+@benchmark("ipfix/decode_message")
+def decode_ipfix() -> Case:
+    corpus = list(synth.IpfixGenerator().messages(CORPUS_SIZE))
+
+    def run():
+        cache = ipfix.TemplateCache()
+        for data in corpus:
+            ipfix.decode_message(data, cache)
+
+    return Case(run, items=len(corpus), bytes=sum(len(d) for d in corpus))
+
+
+def _flow_samples(mix: synth.SflowMix):
+    items = []
+    for data in _corpus(mix):
+        dgram = sflow.decode_datagram(data)
+        for sample in dgram.samples:
+            if isinstance(sample, sflow.FlowSample):
+                items.append(pipeline.AgentSample(dgram.agent_address, sample))
+    return items
+
+
+@benchmark("dissect/flow_sample")
+def dissect_flow_sample() -> Case:
+    samples = [item.sample for item in _flow_samples(synth.SflowMix())]
+
+    def run():
+        for sample in samples:
+            dissect.dissect_flow_sample(sample)
+
+    return Case(run, items=len(samples))
+
+
+@benchmark("pipeline/aggregate")
+def aggregate() -> Case:
+    p = pipeline.Pipeline(exporter=lambda window: None)
+    items = p.dissect_batch(_flow_samples(synth.SflowMix()))
+
+    def run():
+        p.aggregate_batch(items)
+        p.flush_window()
+
+    return Case(run, items=len(items))
+
+
+@benchmark("pipeline/loopback_ingest")
+def loopback_ingest() -> Case:
+    """Datagrams sent over 127.0.0.1 through every pipeline stage."""
+    corpus = _corpus(synth.SflowMix())
+    rx = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    rx.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 8 << 20)
+    rx.bind(("127.0.0.1", 0))
+    tx = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    tx.connect(rx.getsockname())
+    p = pipeline.Pipeline(exporter=lambda window: None)
+    p.start()
+    receiver = threading.Thread(target=p.receive, args=(rx,), daemon=True)
+    receiver.start()
+
+    def run():
+        m = p.metrics
+        target = m.datagrams_decoded + len(corpus)
+        for data in corpus:
+            tx.send(data)
+        deadline = time.monotonic() + 5.0
+        # datagrams the kernel drops never arrive; stop waiting for them
+        while m.datagrams_decoded < target and time.monotonic() < deadline:
+            time.sleep(0.0005)
+
+    def teardown():
+        p.stop()
+        receiver.join()
+        rx.close()
+        tx.close()
+
+    return Case(
+        run,
+        items=len(corpus),
+        bytes=sum(len(d) for d in corpus),
+        teardown=teardown,
+        processed=lambda: p.metrics.datagrams_decoded,
+    )
+
+
+@benchmark("replicator/forward_3_targets")
+def replicate() -> Case:
+    """Per-datagram cost of fanning a received batch out to three targets,
+    one of them filtered."""
+    corpus = _corpus(synth.SflowMix())
+    batch = [(data, None) for data in corpus]
+    sinks = []
+    targets = []
+    for flt in (None, replicator.TargetFilter.create(source_ids=range(1, 9)), None):
+        sink = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        sink.bind(("127.0.0.1", 0))
+        sinks.append(sink)
+        targets.append(replicator.ReplicationTarget(sink.getsockname(), flt))
+    rep = replicator.Replicator(targets)
+    rep.open()
+
+    def run():
+        rep.forward(batch)
+        # keep the sink buffers from filling so sends are not dropped
+        for sink in sinks:
+            sink.setblocking(False)
+            try:
+                while True:
+                    sink.recv(0xFFFF)
+            except BlockingIOError:
+                pass
+
+    def teardown():
+        rep.close()
+        for sink in sinks:
+            sink.close()
+
+    return Case(run, items=len(batch), teardown=teardown)
@@ -0,0 +1,56 @@
+"""sFlow to IPFIX translation throughput."""
+
+import socket
+
+from benchmarks.harness import Case, benchmark
+from benchmarks.bench_sflow import CORPUS_SIZE
+from ipfix_parser import pipeline, sflow, synth, translate
+
+
+def _items():
+    gen = synth.SflowGenerator(synth.SflowMix(counters_ratio=0.2))
+    p = pipeline.Pipeline(exporter=lambda window: None)
+    items = []
+    for data in gen.datagrams(CORPUS_SIZE):
+        dgram = sflow.decode_datagram(data)
+        items += [pipeline.AgentSample(dgram.agent_address, s) for s in dgram.samples]
+    return p.dissect_batch(items)
+
+
+@benchmark("translate/encode")
+def encode() -> Case:
+    items = _items()
+    tr = translate.IpfixTranslator(lambda segments: None)
+
+    def run():
+        tr.translate(items)
+        tr.flush()
+
+    return Case(run, items=len(items))
+
+
+@benchmark("translate/encode_sendmsg")
+def encode_sendmsg() -> Case:
+    """Encode plus one gathering sendmsg() per message over loopback."""
+    items = _items()
+    sink = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sink.bind(("127.0.0.1", 0))
+    sink.setblocking(False)
+    tx = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    tx.connect(sink.getsockname())
+    tr = translate.IpfixTranslator(translate.socket_sink(tx))
+
+    def run():
+        tr.translate(items)
+        tr.flush()
+        try:
+            while True:
+                sink.recv(0xFFFF)
+        except BlockingIOError:
+            pass
+
+    def teardown():
+        sink.close()
+        tx.close()
+
+    return Case(run, items=len(items), teardown=teardown)
@@ -0,0 +1,131 @@
+"""Counter time-series store benchmarks on a synthetic polling fleet.
+
+768 interfaces on 16 agents polled 128 times, so each series fills one
+full block. The fleet benchmark ingests 20k interfaces over ten minutes
+of polls at the default settings: no block fills that soon, so rows are
+buffered and mirrored to the tail file until the final flush. Items are
+rows (one counter block at one poll).
+"""
+
+import os
+import shutil
+import tempfile
+
+from benchmarks.harness import Case, benchmark
+from ipfix_parser import sflow, synth, tsstore
+
+ROUNDS = tsstore.BLOCK_ROWS
+FLEET = synth.FleetMix(agents=400, interfaces_per_agent=50)
+FLEET_ROUNDS = 24  # 8-12 minutes at 20-30 s polling
+
+
+def _fleet_rows(mix=None, rounds=ROUNDS):
+    rows = []
+    for ts, agent, sample in synth.CounterFleet(mix).polls(rounds):
+        for rec in sample.records:
+            rows.append(((agent, sample.source_id, rec.data_format), ts, rec.data))
+    return rows
+
+
+def _filled_store(rows, path: str) -> tsstore.CounterStore:
+    # whole blocks only, as the format is measured here
+    store = tsstore.CounterStore(path, max_age_ms=None)
+    for key, ts, values in rows:
+        store.append(key, ts, values)
+    store.flush()
+    return store
+
+
+def _counters(store: tsstore.CounterStore) -> dict:
+    stats = store.stats
+    return {
+        "compression_ratio": stats.compression_ratio,
+        "bytes_per_row": stats.stored_bytes / stats.rows,
+        "raw_bytes_per_row": stats.raw_bytes / stats.rows,
+    }
+
+
+@benchmark("tsstore/ingest")
+def ingest() -> Case:
+    rows = _fleet_rows()
+    tmp = tempfile.mkdtemp(prefix="tsstore-")
+    path = os.path.join(tmp, "counters.tsb")
+    counters = {}
+
+    def run():
+        if os.path.exists(path):
+            os.unlink(path)
+        store = _filled_store(rows, path)
+        counters.update(_counters(store))
+        store.close()
+
+    run()
+    return Case(
+        run,
+        items=len(rows),
+        counters=counters,
+        teardown=lambda: shutil.rmtree(tmp),
+    )
+
+
+@benchmark("tsstore/ingest_fleet_20k")
+def ingest_fleet() -> Case:
+    rows = _fleet_rows(FLEET, FLEET_ROUNDS)
+    interfaces = FLEET.agents * FLEET.interfaces_per_agent
+    tmp = tempfile.mkdtemp(prefix="tsstore-")
+    path = os.path.join(tmp, "counters.tsb")
+    counters = {}
+
+    def run():
+        if os.path.exists(path):
+            os.unlink(path)
+        store = tsstore.CounterStore(path)
+        peak = 0
+        for key, ts, values in rows:
+            store.append(key, ts, values)
+            if store.buffered_bytes > peak:
+                peak = store.buffered_bytes
+        store.flush()
+        counters.update(_counters(store))
+        counters["rows_per_block"] = store.stats.rows / store.stats.blocks
+        counters["peak_buffered_bytes_per_interface"] = peak / interfaces
+        store.close()
+
+    return Case(
+        run,
+        items=len(rows),
+        counters=counters,
+        teardown=lambda: shutil.rmtree(tmp),
+    )
+
+
+def _scan_case(fields) -> Case:
+    rows = _fleet_rows()
+    tmp = tempfile.mkdtemp(prefix="tsstore-")
+    store = _filled_store(rows, os.path.join(tmp, "counters.tsb"))
+    keys = list(store.series)
+    if fields is not None:
+        keys = [k for k in keys if k[2] == sflow.COUNTERS_IF]
+
+    def run():
+        for key in keys:
+            for _ in store.scan(key, fields=fields):
+                pass
+
+    def teardown():
+        store.close()
+        shutil.rmtree(tmp)
+
+    items = sum(b.rows for k in keys for b in store.series[k].blocks)
+    return Case(run, items=items, counters=_counters(store), teardown=teardown)
+
+
+@benchmark("tsstore/scan_all_columns")
+def scan_all() -> Case:
+    return _scan_case(None)
+
+
+@benchmark("tsstore/scan_octets")
+def scan_octets() -> Case:
+    """Only in_octets and out_octets of if_counters are unpacked."""
+    return _scan_case(("in_octets", "out_octets"))
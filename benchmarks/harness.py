@@ -0,0 +1,133 @@
+"""Minimal benchmark runner.
+
+Benchmarks register a setup function with @benchmark. The setup builds its
+fixture and returns a Case; the runner then times Case.run until at least
+`min_time` seconds have elapsed and reports per-iteration time plus item
+and byte rates. Results are written in the JSON layout used by Google
+Benchmark (--benchmark_format=json) so its compare.py tooling can diff
+two runs.
+"""
+
+import argparse
+import json
+import os
+import platform
+import re
+import sys
+import time
+from dataclasses import dataclass
+from typing import Callable, Dict, List, Optional
+
+DEFAULT_MIN_TIME = 0.5
+
+
+@dataclass
+class Case:
+    run: Callable[[], object]
+    items: int = 1  # items processed per call of run()
+    bytes: int = 0  # bytes processed per call of run()
+    teardown: Optional[Callable[[], None]] = None
+    # extra counters reported with the result, e.g. compression ratio
+    counters: Optional[Dict[str, float]] = None
+    # running total of items actually processed, for runs that may give
+    # up on some (e.g. datagrams lost on loopback); overrides `items`, and
+    # the byte rate is scaled by the fraction of `items` processed
+    processed: Optional[Callable[[], int]] = None
+
+
+_REGISTRY: Dict[str, Callable[[], Case]] = {}
+
+
+def benchmark(name: str):
+    def register(setup: Callable[[], Case]) -> Callable[[], Case]:
+        if name in _REGISTRY:
+            raise ValueError(f"duplicate benchmark: {name}")
+        _REGISTRY[name] = setup
+        return setup
+
+    return register
+
+
+def run_case(name: str, case: Case, min_time: float) -> dict:
+    case.run()  # warm up
+    processed = case.processed() if case.processed else 0
+    iterations = 0
+    start = time.perf_counter()
+    cpu_start = time.process_time()
+    elapsed = 0.0
+    while elapsed < min_time:
+        case.run()
+        iterations += 1
+        elapsed = time.perf_counter() - start
+    cpu = time.process_time() - cpu_start
+    if case.processed:
+        items = case.processed() - processed
+        nbytes = case.bytes * items / case.items
+    else:
+        items = case.items * iterations
+        nbytes = case.bytes * iterations
+    result = {
+        "name": name,
+        "run_name": name,
+        "run_type": "iteration",
+        "iterations": iterations,
+        "real_time": elapsed / iterations * 1e9,
+        "cpu_time": cpu / iterations * 1e9,
+        "time_unit": "ns",
+        "items_per_second": items / elapsed,
+    }
+    if case.bytes:
+        result["bytes_per_second"] = nbytes / elapsed
+    if case.counters:
+        result.update(case.counters)
+    return result
+
+
+def context() -> dict:
+    return {
+        "date": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+        "host_name": platform.node(),
+        "executable": sys.executable,
+        "num_cpus": os.cpu_count(),
+        "python_version": platform.python_version(),
+        "library_build_type": "release",
+    }
+
+
+def main(argv: Optional[List[str]] = None) -> int:
+    parser = argparse.ArgumentParser(description="ipfix_parser benchmarks")
+    parser.add_argument("--filter", default=".", help="regex on benchmark names")
+    parser.add_argument("--min-time", type=float, default=DEFAULT_MIN_TIME)
+    parser.add_argument("--out", help="write JSON results to this file")
+    parser.add_argument("--list", action="store_true")
+    args = parser.parse_args(argv)
+
+    pattern = re.compile(args.filter)
+    names = [n for n in _REGISTRY if pattern.search(n)]
+    if args.list:
+        print("\n".join(names))
+        return 0
+
+    results = []
+    for name in names:
+        case = _REGISTRY[name]()
+        try:
+            result = run_case(name, case, args.min_time)
+        finally:
+            if case.teardown is not None:
+                case.teardown()
+        results.append(result)
+        print(
+            f"{name:<40} {result['real_time']:>14.0f} ns "
+            f"{result['items_per_second']:>14.0f} items/s",
+            file=sys.stderr,
+        )
+
+    report = {"context": context(), "benchmarks": results}
+    if args.out:
+        with open(args.out, "w") as f:
+            json.dump(report, f, indent=2)
+    else:
+        json.dump(report, sys.stdout, indent=2)
+        print()
+    return 0
@@ -0,0 +1,402 @@
+"""Checkpoint and restore of long-lived collector state.
+
+State that outlives a batch (agent sequence baselines, the last
+if_counters per interface, the open aggregation window) is held in
+CowTables. A checkpoint asks each table's owning stage to freeze it at a
+batch boundary: the current generation becomes read-only for the
+checkpoint thread to serialise, and the stage carries on against a fresh
+one, copying an entry over the first time it touches it. Once the
+snapshot is written the owner folds the two generations back together.
+The stage never waits on the checkpoint and never copies a whole table.
+
+Snapshots are flat files of fixed-layout records located by offsets
+from the start of the file, so they are valid wherever they are mapped.
+read_snapshot() maps the file and decodes from the mapping. Files are
+written next to the target and renamed into place, so a crash during a
+checkpoint leaves the previous snapshot intact.
+"""
+
+import mmap
+import os
+import struct
+import threading
+import time
+from dataclasses import dataclass, field
+from typing import Callable, Dict, Iterator, List, Mapping, Optional, Tuple
+
+from ipfix_parser import dissect, ipfix, sflow
+
+SNAPSHOT_MAGIC = b"CKP1"
+SNAPSHOT_VERSION = 1
+
+# magic, version, section count, epoch, creation time (ms)
+_HEADER = struct.Struct("!4sHHQQ")
+# section name, offset, record count
+_SECTION = struct.Struct("!8sQQ")
+
+# agent length, agent, sub_agent_id, last datagram sequence number
+_SEQ = struct.Struct("!B16sII")
+# agent length, agent, source_id, if_counters
+_IF_COUNTERS = struct.Struct(
+    "!B16sI" + sflow.COUNTER_FORMATS[sflow.COUNTERS_IF][0].format.lstrip("!")
+)
+# agent length, agent, input, output, then the Dissection (address
+# length, vlan, ethertype, addresses, protocol, ports, tos) and totals
+_FLOW = struct.Struct("!B16sIIBHH16s16sBHHBQQQ")
+# window start (ms since the epoch), IPFIX export sequence number
+_META = struct.Struct("!QI")
+
+_TOMBSTONE = object()
+
+
+class CowTable:
+    """A dict that can be frozen for a checkpoint without copying it.
+
+    Only the owning thread reads, mutates or poll()s the table. Any thread
+    may request_freeze(), read `frozen` once it is granted and release()
+    it afterwards; the owner acts on both at its next poll(). With a
+    `copy` function, get() hands out a private copy of a frozen entry so
+    the caller may mutate it; without one, values are treated as
+    immutable and replaced through item assignment.
+    """
+
+    def __init__(self, copy: Optional[Callable] = None) -> None:
+        self._copy = copy
+        self._live: dict = {}
+        self._frozen: Optional[dict] = None
+        self._shadowed = False  # clear() hid the frozen generation
+        self._want_freeze = False
+        self._want_thaw = False
+        self._granted = threading.Event()
+
+    def get(self, key, default=None):
+        v = self._live.get(key)
+        if v is None and self._frozen is not None and not self._shadowed:
+            v = self._frozen.get(key)
+            if v is not None and self._copy is not None:
+                v = self._copy(v)
+                self._live[key] = v
+        return default if v is None or v is _TOMBSTONE else v
+
+    def __setitem__(self, key, value) -> None:
+        self._live[key] = value
+
+    def __contains__(self, key) -> bool:
+        return self.get(key) is not None
+
+    def pop(self, key, default=None):
+        v = self.get(key)
+        if self._frozen is not None and not self._shadowed and key in self._frozen:
+            self._live[key] = _TOMBSTONE
+        else:
+            self._live.pop(key, None)
+        return default if v is None else v
+
+    def clear(self) -> None:
+        self._live = {}
+        if self._frozen is not None:
+            self._shadowed = True
+
+    def items(self) -> Iterator[tuple]:
+        live = self._live
+        for k, v in live.items():
+            if v is not _TOMBSTONE:
+                yield k, v
+        if self._frozen is not None and not self._shadowed:
+            for k, v in self._frozen.items():
+                if k not in live:
+                    yield k, v
+
+    def values(self) -> Iterator:
+        return (v for _, v in self.items())
+
+    def __len__(self) -> int:
+        return sum(1 for _ in self.items())
+
+    def update(self, entries: Mapping) -> None:
+        self._live.update(entries)
+
+    # -- checkpoint protocol ---------------------------------------------------
+
+    def request_freeze(self) -> None:
+        self._granted.clear()
+        self._want_freeze = True
+
+    def wait_frozen(self, timeout: float) -> bool:
+        return self._granted.wait(timeout)
+
+    @property
+    def frozen(self) -> Optional[dict]:
+        return self._frozen if self._granted.is_set() else None
+
+    def release(self) -> None:
+        self._granted.clear()
+        self._want_thaw = True
+
+    def poll(self) -> None:
+        """Owner only: act on a pending release or freeze request."""
+        if self._want_thaw:
+            self._want_thaw = False
+            if self._frozen is not None:
+                self._thaw()
+        if self._want_freeze:
+            self._want_freeze = False
+            if self._frozen is None:
+                self._frozen = self._live
+                self._live = {}
+                self._granted.set()
+
+    def _thaw(self) -> None:
+        if self._shadowed:
+            merged = {k: v for k, v in self._live.items() if v is not _TOMBSTONE}
+        else:
+            # only what changed since the freeze is touched
+            merged = self._frozen
+            for k, v in self._live.items():
+                if v is _TOMBSTONE:
+                    merged.pop(k, None)
+                else:
+                    merged[k] = v
+        self._live = merged
+        self._frozen = None
+        self._shadowed = False
+
+
+def _pad16(data: bytes) -> bytes:
+    return data + bytes(16 - len(data))
+
+
+@dataclass
+class Snapshot:
+    epoch: int = 0
+    created_ms: int = 0
+    # (agent, sub_agent_id) -> last datagram sequence number
+    agent_sequences: Dict[Tuple[bytes, int], int] = field(default_factory=dict)
+    # (agent, source_id) -> last IfCounters
+    if_counters: Dict[Tuple[bytes, int], sflow.IfCounters] = field(default_factory=dict)
+    # (agent, input, output, Dissection, bytes, packets, samples) of the
+    # open aggregation window
+    flows: List[tuple] = field(default_factory=list)
+    window_start_ms: int = 0
+    export_sequence: int = 0
+    # exporter name -> learned IPFIX templates
+    templates: Dict[str, ipfix.TemplateCache] = field(default_factory=dict)
+
+
+def _encode_templates(name: str, cache_items) -> List[bytes]:
+    """Templates as IPFIX template messages, prefixed with the exporter
+    name. One message per domain and set type, split to stay within the
+    16-bit message length."""
+    by_set: Dict[Tuple[int, bool], List[bytes]] = {}
+    for (domain, _tid), template in cache_items:
+        key = (domain, template.scope_count > 0)
+        by_set.setdefault(key, []).append(ipfix.encode_template_record(template))
+    raw_name = name.encode()
+    prefix = bytes((len(raw_name),)) + raw_name
+    limit = 0xFFFF - ipfix.MESSAGE_HEADER_LEN - ipfix.SET_HEADER_LEN
+    out = []
+    for (domain, options), records in sorted(by_set.items()):
+        set_id = ipfix.SET_ID_OPTIONS_TEMPLATE if options else ipfix.SET_ID_TEMPLATE
+        chunk: List[bytes] = []
+        size = 0
+        for rec in records + [None]:
+            if chunk and (rec is None or size + len(rec) > limit):
+                body = ipfix.encode_set(set_id, b"".join(chunk))
+                out.append(prefix + ipfix.encode_message([body], 0, 0, domain))
+                chunk = []
+                size = 0
+            if rec is not None:
+                chunk.append(rec)
+                size += len(rec)
+    return out
+
+
+def encode_snapshot(
+    snapshot_epoch: int,
+    agent_sequences: Mapping,
+    if_counters: Mapping,
+    flows,
+    window_start_ms: int,
+    export_sequence: int,
+    templates: Mapping[str, ipfix.TemplateCache],
+) -> bytes:
+    sections = []
+
+    rows = [
+        _SEQ.pack(len(agent), _pad16(agent), sub_agent, seq)
+        for (agent, sub_agent), seq in agent_sequences.items()
+    ]
+    sections.append((b"seq", len(rows), b"".join(rows)))
+
+    rows = [
+        _IF_COUNTERS.pack(len(agent), _pad16(agent), source_id, *counters)
+        for (agent, source_id), counters in if_counters.items()
+    ]
+    sections.append((b"ifctr", len(rows), b"".join(rows)))
+
+    rows = []
+    for agg in flows:
+        k = agg.key
+        rows.append(
+            _FLOW.pack(
+                len(agg.agent_address),
+                _pad16(agg.agent_address),
+                agg.input,
+                agg.output,
+                len(k.src_ip),
+                k.vlan,
+                k.ethertype,
+                _pad16(k.src_ip),
+                _pad16(k.dst_ip),
+                k.protocol,
+                k.src_port,
+                k.dst_port,
+                k.tos,
+                agg.bytes,
+                agg.packets,
+                agg.samples,
+            )
+        )
+    sections.append((b"flows", len(rows), b"".join(rows)))
+
+    sections.append((b"meta", 1, _META.pack(window_start_ms, export_sequence)))
+
+    rows = []
+    # plain list copies are atomic under the GIL and template caches are
+    # small, so they need no copy-on-write; collectors add and drop
+    # caches while this runs
+    for name, cache in list(templates.items()):
+        rows += _encode_templates(name, list(cache.templates.items()))
+    sections.append((b"tmpl", len(rows), b"".join(rows)))
+
+    offset = _HEADER.size + _SECTION.size * len(sections)
+    header = [
+        _HEADER.pack(
+            SNAPSHOT_MAGIC,
+            SNAPSHOT_VERSION,
+            len(sections),
+            snapshot_epoch,
+            int(time.time() * 1000),
+        )
+    ]
+    for name, count, body in sections:
+        header.append(_SECTION.pack(name, offset, count))
+        offset += len(body)
+    return b"".join(header + [body for _, _, body in sections])
+
+
+def write_snapshot(path: str, data: bytes) -> None:
+    tmp = path + ".tmp"
+    with open(tmp, "wb") as f:
+        f.write(data)
+        f.flush()
+        os.fsync(f.fileno())
+    os.replace(tmp, path)
+
+
+class SnapshotWriter:
+    """Writes snapshots on a thread of its own, so whoever encodes them
+    never waits on fsync(). Only the newest snapshot handed over is kept:
+    one superseded before the thread gets to it is never written.
+    `on_done` is called from the writer thread with whether the write
+    succeeded."""
+
+    def __init__(self, on_done: Callable[[bool], None]) -> None:
+        self._on_done = on_done
+        self._cond = threading.Condition()
+        self._pending: Optional[Tuple[str, bytes]] = None
+        self._busy = False
+        self._closed = False
+        self._thread = threading.Thread(
+            target=self._run, name="snapshot-writer", daemon=True
+        )
+        self._thread.start()
+
+    def submit(self, path: str, data: bytes) -> None:
+        with self._cond:
+            self._pending = (path, data)
+            self._cond.notify_all()
+
+    def flush(self) -> None:
+        """Wait until everything submitted so far is written or failed."""
+        with self._cond:
+            self._cond.wait_for(lambda: self._pending is None and not self._busy)
+
+    def close(self) -> None:
+        self.flush()
+        with self._cond:
+            self._closed = True
+            self._cond.notify_all()
+        self._thread.join()
+
+    def _run(self) -> None:
+        while True:
+            with self._cond:
+                self._cond.wait_for(lambda: self._pending is not None or self._closed)
+                if self._pending is None:
+                    return
+                path, data = self._pending
+                self._pending = None
+                self._busy = True
+            try:
+                write_snapshot(path, data)
+                ok = True
+            except OSError:
+                ok = False
+            self._on_done(ok)
+            with self._cond:
+                self._busy = False
+                self._cond.notify_all()
+
+
+def decode_snapshot(buf) -> Snapshot:
+    magic, version, count, epoch, created_ms = _HEADER.unpack_from(buf, 0)
+    if magic != SNAPSHOT_MAGIC or version != SNAPSHOT_VERSION:
+        raise ValueError("not a collector snapshot")
+    snap = Snapshot(epoch, created_ms)
+    sections = {}
+    for i in range(count):
+        name, offset, rows = _SECTION.unpack_from(buf, _HEADER.size + i * _SECTION.size)
+        sections[name.rstrip(b"\0")] = (offset, rows)
+
+    off, rows = sections.get(b"seq", (0, 0))
+    for alen, agent, sub_agent, seq in _SEQ.iter_unpack(
+        buf[off : off + rows * _SEQ.size]
+    ):
+        snap.agent_sequences[(agent[:alen], sub_agent)] = seq
+
+    off, rows = sections.get(b"ifctr", (0, 0))
+    for row in _IF_COUNTERS.iter_unpack(buf[off : off + rows * _IF_COUNTERS.size]):
+        snap.if_counters[(row[1][: row[0]], row[2])] = sflow.IfCounters._make(row[3:])
+
+    off, rows = sections.get(b"flows", (0, 0))
+    for row in _FLOW.iter_unpack(buf[off : off + rows * _FLOW.size]):
+        alen, agent, input, output, iplen, vlan, ethertype, src, dst = row[:9]
+        proto, sport, dport, tos, nbytes, packets, samples = row[9:]
+        key = dissect.Dissection(
+            vlan, ethertype, src[:iplen], dst[:iplen], proto, sport, dport, tos
+        )
+        snap.flows.append((agent[:alen], input, output, key, nbytes, packets, samples))
+
+    off, _ = sections[b"meta"]
+    snap.window_start_ms, snap.export_sequence = _META.unpack_from(buf, off)
+
+    off, rows = sections.get(b"tmpl", (0, 0))
+    for _ in range(rows):
+        nlen = buf[off]
+        name = bytes(buf[off + 1 : off + 1 + nlen]).decode()
+        off += 1 + nlen
+        cache = snap.templates.setdefault(name, ipfix.TemplateCache())
+        msg = ipfix.decode_message(buf, cache, off)
+        off += msg.header.length
+    return snap
+
+
+def read_snapshot(path: str) -> Snapshot:
+    with open(path, "rb") as f:
+        with mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as m:
+            view = memoryview(m)
+            try:
+                return decode_snapshot(view)
+            finally:
+                view.release()
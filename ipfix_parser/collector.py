@@ -0,0 +1,475 @@
+"""IPFIX collector over UDP and TCP.
+
+A single selectors loop (epoll on Linux) accepts exporter connections and
+reads UDP datagrams. Both transports end in the same path: a memoryview
+of one complete message handed to ipfix.decode_message(), and the decoded
+Message handed to the sink.
+
+Each TCP connection reads into its own StreamBuffer, which frames
+messages by the header length without copying them out. The buffer is
+`capacity` bytes plus room for one maximum-size message past the end: a
+message that starts before `capacity` is always completed contiguously in
+that slack, and reading only wraps back to offset 0 once the buffer is
+empty. No message is ever split across the wrap point, so none has to be
+reassembled.
+
+When the sink refuses a message, the connection stops being read until
+the sink accepts it. The kernel receive buffer then fills, and TCP flow
+control slows the exporter instead of the collector queueing more data.
+UDP has no flow control, so refused datagrams are dropped and counted.
+Per RFC 7011 templates learned over TCP belong to the session and are
+discarded when it closes, so they live on the connection only. UDP
+templates are kept per exporter address in `template_caches`, the only
+templates that are checkpointed.
+
+With a checkpoint path, serve() snapshots the UDP templates periodically
+in the same format as the sFlow pipeline (see ipfix_parser.checkpoint),
+so a restarted collector decodes data sets before exporters resend
+their templates. Snapshots are encoded on the polling thread, which owns
+the caches, and written by a SnapshotWriter thread, so fsync() never
+stalls the connections. A failed write is counted and retried at the
+next interval.
+
+Running out of file descriptors (EMFILE/ENFILE) while accepting stops
+the listener being polled for `accept_backoff` seconds. Connections left
+waiting stay in the listen backlog meanwhile, and existing connections
+keep being served.
+"""
+
+import argparse
+import errno
+import os
+import selectors
+import socket
+import struct
+import sys
+import threading
+import time
+from dataclasses import dataclass, fields
+from typing import Callable, Dict, List, Optional, Tuple
+
+from ipfix_parser import ipfix
+from ipfix_parser.checkpoint import (
+    Snapshot,
+    SnapshotWriter,
+    encode_snapshot,
+    read_snapshot,
+)
+
+MAX_MESSAGE = 0xFFFF
+DEFAULT_BUFFER = 256 << 10  # bytes per TCP connection, plus MAX_MESSAGE
+DEFAULT_BACKLOG = 1024
+DEFAULT_CHECKPOINT_INTERVAL = 30.0  # seconds
+DEFAULT_ACCEPT_BACKOFF = 1.0  # seconds without accepting after EMFILE
+
+_IDLE_WAIT = 0.05
+_VERSION_LENGTH = struct.Struct("!HH")
+# accept() errors that clear up once descriptors or memory are released
+_ACCEPT_EXHAUSTED = (errno.EMFILE, errno.ENFILE, errno.ENOBUFS, errno.ENOMEM)
+
+Sink = Callable[[str, ipfix.Message], bool]
+
+
+class FramingError(ValueError):
+    """The stream does not start with an IPFIX message header."""
+
+
+class StreamBuffer:
+    """Receive buffer that yields whole IPFIX messages as memoryviews.
+
+    Views returned by next_frame() are valid until the next call to
+    writable(); callers decode them before reading more.
+    """
+
+    def __init__(self, capacity: int = DEFAULT_BUFFER) -> None:
+        self.capacity = capacity
+        self.buf = bytearray(capacity + MAX_MESSAGE)
+        self.view = memoryview(self.buf)
+        self.head = 0  # start of the first message not yet framed
+        self.tail = 0  # end of received data
+
+    def __len__(self) -> int:
+        return self.tail - self.head
+
+    def _needed(self) -> int:
+        """Bytes of the message at head that must be present to frame it."""
+        if self.tail - self.head < ipfix.MESSAGE_HEADER_LEN:
+            return ipfix.MESSAGE_HEADER_LEN
+        return _VERSION_LENGTH.unpack_from(self.buf, self.head)[1]
+
+    def writable(self) -> memoryview:
+        """The region the next recv_into() may fill."""
+        if self.head == self.tail:
+            self.head = self.tail = 0
+        if self.tail < self.capacity:
+            limit = self.capacity
+        else:
+            # past the wrap point: finish the message at head, nothing more
+            limit = self.head + self._needed()
+        return self.view[self.tail : limit]
+
+    def next_frame(self) -> Optional[memoryview]:
+        available = self.tail - self.head
+        if available < ipfix.MESSAGE_HEADER_LEN:
+            return None
+        version, length = _VERSION_LENGTH.unpack_from(self.buf, self.head)
+        if version != ipfix.IPFIX_VERSION or length < ipfix.MESSAGE_HEADER_LEN:
+            raise FramingError(f"bad IPFIX header: version {version} length {length}")
+        if available < length:
+            return None
+        frame = self.view[self.head : self.head + length]
+        self.head += length
+        return frame
+
+
+@dataclass
+class CollectorMetrics:
+    connections_accepted: int = 0
+    connections_closed: int = 0
+    connections_paused: int = 0
+    messages: int = 0
+    records: int = 0
+    bytes: int = 0
+    decode_errors: int = 0
+    framing_errors: int = 0
+    truncated_streams: int = 0
+    udp_messages_dropped: int = 0
+    accept_errors: int = 0
+    accept_pauses: int = 0  # listeners backed off on EMFILE/ENFILE
+    checkpoints: int = 0
+    checkpoint_errors: int = 0
+
+    def snapshot(self) -> Dict[str, int]:
+        return {f.name: getattr(self, f.name) for f in fields(self)}
+
+
+class _Connection:
+    __slots__ = ("sock", "name", "buffer", "cache", "pending", "paused")
+
+    def __init__(self, sock: socket.socket, name: str, capacity: int) -> None:
+        self.sock = sock
+        self.name = name
+        self.buffer = StreamBuffer(capacity)
+        self.cache = ipfix.TemplateCache()
+        self.pending: Optional[ipfix.Message] = None
+        self.paused = False
+
+
+def print_sink(exporter: str, msg: ipfix.Message) -> bool:
+    hdr = msg.header
+    print(
+        f"exporter: {exporter} domain: {hdr.domain_id} seq: {hdr.sequence_number} "
+        f"templates: {len(msg.templates)} records: {len(msg.records)}"
+    )
+    return True
+
+
+class IpfixCollector:
+    """Receives IPFIX on any number of UDP and TCP listeners."""
+
+    def __init__(
+        self,
+        sink: Sink = print_sink,
+        buffer_size: int = DEFAULT_BUFFER,
+        template_caches: Optional[Dict[str, ipfix.TemplateCache]] = None,
+        checkpoint_path: Optional[str] = None,
+        checkpoint_interval: float = DEFAULT_CHECKPOINT_INTERVAL,
+    ) -> None:
+        self.sink = sink
+        self.buffer_size = buffer_size
+        # UDP exporter name -> templates; pass Pipeline.template_caches to
+        # have them checkpointed
+        self.template_caches = {} if template_caches is None else template_caches
+        self.metrics = CollectorMetrics()
+        self.selector = selectors.DefaultSelector()
+        self.connections: Dict[int, _Connection] = {}
+        self._paused: List[_Connection] = []
+        self._listeners: List[socket.socket] = []
+        self._datagram = bytearray(MAX_MESSAGE)
+        self._datagram_view = memoryview(self._datagram)
+        self.accept_backoff = DEFAULT_ACCEPT_BACKOFF
+        self._accept_paused: List[socket.socket] = []
+        self._accept_resume_at = 0.0
+        self.checkpoint_path = checkpoint_path
+        self.checkpoint_interval = checkpoint_interval
+        self._epoch = 0
+        self._next_checkpoint = time.monotonic() + checkpoint_interval
+        self._writer: Optional[SnapshotWriter] = None
+
+    # -- setup -------------------------------------------------------------
+
+    def listen_tcp(self, host: str, port: int, backlog: int = DEFAULT_BACKLOG):
+        family = socket.AF_INET6 if ":" in host else socket.AF_INET
+        sock = socket.socket(family, socket.SOCK_STREAM)
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        sock.bind((host, port))
+        sock.listen(backlog)
+        sock.setblocking(False)
+        self.selector.register(sock, selectors.EVENT_READ, self._accept)
+        self._listeners.append(sock)
+        return sock.getsockname()
+
+    def listen_udp(self, host: str, port: int, rcvbuf: int = 8 << 20):
+        family = socket.AF_INET6 if ":" in host else socket.AF_INET
+        sock = socket.socket(family, socket.SOCK_DGRAM)
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, rcvbuf)
+        sock.bind((host, port))
+        sock.setblocking(False)
+        self.selector.register(sock, selectors.EVENT_READ, self._read_udp)
+        self._listeners.append(sock)
+        return sock.getsockname()
+
+    def close(self) -> None:
+        for conn in list(self.connections.values()):
+            self._close(conn)
+        for sock in self._listeners:
+            if sock not in self._accept_paused:
+                self.selector.unregister(sock)
+            sock.close()
+        self._listeners = []
+        self._accept_paused = []
+        self.selector.close()
+        if self._writer is not None:
+            self._writer.close()
+            self._writer = None
+
+    # -- event loop ----------------------------------------------------------
+
+    def poll(self, timeout: float = _IDLE_WAIT) -> None:
+        if self._accept_paused:
+            wait = self._accept_resume_at - time.monotonic()
+            if wait <= 0:
+                self._resume_accept()
+            else:
+                timeout = min(timeout, wait)
+        if self._paused:
+            self._resume_paused()
+            # paused connections have data waiting; do not sleep on them
+            if self._paused:
+                timeout = min(timeout, 0.001)
+        for key, _ in self.selector.select(timeout):
+            key.data(key.fileobj)
+
+    def serve(self, stop: threading.Event) -> None:
+        while not stop.is_set():
+            self.poll()
+            if (
+                self.checkpoint_path is not None
+                and time.monotonic() >= self._next_checkpoint
+            ):
+                self.checkpoint(wait=False)
+
+    # -- checkpoints -------------------------------------------------------
+
+    def checkpoint(self, path: Optional[str] = None, wait: bool = True) -> int:
+        """Snapshot the UDP template caches to `path`; returns its size.
+
+        Call from the thread that runs poll(), which owns the caches. The
+        file is written by the writer thread; with `wait` this returns
+        once it is written, or its failure counted in checkpoint_errors.
+        """
+        self._epoch += 1
+        data = encode_snapshot(
+            self._epoch, {}, {}, (), int(time.time() * 1000), 0, self.template_caches
+        )
+        if self._writer is None:
+            self._writer = SnapshotWriter(self._checkpoint_done)
+        self._writer.submit(path or self.checkpoint_path, data)
+        if wait:
+            self._writer.flush()
+        self._next_checkpoint = time.monotonic() + self.checkpoint_interval
+        return len(data)
+
+    def _checkpoint_done(self, ok: bool) -> None:
+        """Writer thread: the only place these two counters change."""
+        if ok:
+            self.metrics.checkpoints += 1
+        else:
+            self.metrics.checkpoint_errors += 1
+
+    def restore(self, path: Optional[str] = None) -> Snapshot:
+        """Load the UDP templates of a snapshot. Call before serving."""
+        snap = read_snapshot(path or self.checkpoint_path)
+        self._epoch = snap.epoch
+        for name, cache in snap.templates.items():
+            # older snapshots may hold TCP session templates; drop them
+            if name.startswith("udp:"):
+                self.template_caches[name] = cache
+        return snap
+
+    # -- decode path ---------------------------------------------------------
+
+    def _decode(self, exporter: str, frame, cache: ipfix.TemplateCache):
+        m = self.metrics
+        m.messages += 1
+        m.bytes += len(frame)
+        try:
+            msg = ipfix.decode_message(frame, cache)
+        except ipfix.DecodeError:
+            m.decode_errors += 1
+            return None
+        m.records += len(msg.records)
+        return msg
+
+    def _read_udp(self, sock: socket.socket) -> None:
+        view = self._datagram_view
+        while True:
+            try:
+                n, addr = sock.recvfrom_into(self._datagram)
+            except BlockingIOError:
+                return
+            exporter = f"udp:{addr[0]}"
+            cache = self.template_caches.get(exporter)
+            if cache is None:
+                cache = self.template_caches[exporter] = ipfix.TemplateCache()
+            msg = self._decode(exporter, view[:n], cache)
+            if msg is not None and not self.sink(exporter, msg):
+                self.metrics.udp_messages_dropped += 1
+
+    # -- TCP -------------------------------------------------------------------
+
+    def _accept(self, listener: socket.socket) -> None:
+        while True:
+            try:
+                sock, addr = listener.accept()
+            except BlockingIOError:
+                return
+            except OSError as e:
+                self.metrics.accept_errors += 1
+                if e.errno in _ACCEPT_EXHAUSTED:
+                    self._pause_accept(listener)
+                    return
+                continue  # e.g. ECONNABORTED: that connection is gone
+            sock.setblocking(False)
+            conn = _Connection(sock, f"tcp:{addr[0]}:{addr[1]}", self.buffer_size)
+            self.connections[sock.fileno()] = conn
+            self.selector.register(sock, selectors.EVENT_READ, self._read_tcp)
+            self.metrics.connections_accepted += 1
+
+    def _pause_accept(self, listener: socket.socket) -> None:
+        """Stop polling a listener that would fail again at once, which
+        would otherwise spin the loop."""
+        self.selector.unregister(listener)
+        self._accept_paused.append(listener)
+        self._accept_resume_at = time.monotonic() + self.accept_backoff
+        self.metrics.accept_pauses += 1
+
+    def _resume_accept(self) -> None:
+        for listener in self._accept_paused:
+            self.selector.register(listener, selectors.EVENT_READ, self._accept)
+        self._accept_paused = []
+
+    def _read_tcp(self, sock: socket.socket) -> None:
+        conn = self.connections[sock.fileno()]
+        buf = conn.buffer
+        try:
+            n = sock.recv_into(buf.writable())
+        except BlockingIOError:
+            return
+        except OSError:
+            n = 0
+        if n == 0:
+            if len(buf):
+                self.metrics.truncated_streams += 1
+            self._close(conn)
+            return
+        buf.tail += n
+        self._drain(conn)
+
+    def _drain(self, conn: _Connection) -> None:
+        """Decode and deliver every complete message in the buffer."""
+        buf = conn.buffer
+        while True:
+            try:
+                frame = buf.next_frame()
+            except FramingError:
+                # message boundaries are lost; the stream cannot recover
+                self.metrics.framing_errors += 1
+                self._close(conn)
+                return
+            if frame is None:
+                return
+            msg = self._decode(conn.name, frame, conn.cache)
+            if msg is not None and not self.sink(conn.name, msg):
+                conn.pending = msg
+                self._pause(conn)
+                return
+
+    def _pause(self, conn: _Connection) -> None:
+        self.selector.unregister(conn.sock)
+        conn.paused = True
+        self._paused.append(conn)
+        self.metrics.connections_paused += 1
+
+    def _resume_paused(self) -> None:
+        paused, self._paused = self._paused, []
+        for conn in paused:
+            if not conn.paused:
+                continue  # closed meanwhile
+            if not self.sink(conn.name, conn.pending):
+                self._paused.append(conn)
+                continue
+            conn.pending = None
+            conn.paused = False
+            self.selector.register(conn.sock, selectors.EVENT_READ, self._read_tcp)
+            # messages already buffered behind the refused one
+            self._drain(conn)
+
+    def _close(self, conn: _Connection) -> None:
+        if not conn.paused:
+            self.selector.unregister(conn.sock)
+        conn.paused = False
+        # templates on a TCP session go with it
+        del self.connections[conn.sock.fileno()]
+        conn.sock.close()
+        self.metrics.connections_closed += 1
+
+
+def run(
+    host: str = "0.0.0.0", port: int = 4739, checkpoint_path: Optional[str] = None
+) -> int:
+    collector = IpfixCollector(checkpoint_path=checkpoint_path)
+    if checkpoint_path is not None and os.path.exists(checkpoint_path):
+        snap = collector.restore()
+        print(f"restored checkpoint epoch {snap.epoch}")
+    collector.listen_udp(host, port)
+    collector.listen_tcp(host, port)
+    stop = threading.Event()
+    try:
+        collector.serve(stop)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if checkpoint_path is not None:
+            collector.checkpoint()
+        collector.close()
+        print(collector.metrics.snapshot())
+    return 0
+
+
+def _host_port(arg: str) -> Tuple[str, int]:
+    host, port = arg.rsplit(":", 1)
+    return host, int(port)
+
+
+def add_checkpoint_argument(parser: argparse.ArgumentParser) -> None:
+    parser.add_argument(
+        "--checkpoint",
+        metavar="PATH",
+        help="snapshot UDP exporter templates here and resume from it",
+    )
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="IPFIX collector")
+    parser.add_argument(
+        "listen",
+        nargs="?",
+        type=_host_port,
+        default=("0.0.0.0", 4739),
+        metavar="host:port",
+        help="UDP and TCP address to listen on",
+    )
+    add_checkpoint_argument(parser)
+    args = parser.parse_args()
+    sys.exit(run(*args.listen, checkpoint_path=args.checkpoint))
@@ -0,0 +1,118 @@
+"""Dissection of sampled packet headers into flow keys."""
+import struct
+from collections import namedtuple
+from typing import Optional
+
+from ipfix_parser import sflow
+
+ETHERTYPE_IPV4 = 0x0800
+ETHERTYPE_IPV6 = 0x86DD
+ETHERTYPE_VLAN = 0x8100
+ETHERTYPE_QINQ = 0x88A8
+
+IPPROTO_TCP = 6
+IPPROTO_UDP = 17
+IPPROTO_SCTP = 132
+
+_PORTS = struct.Struct("!HH")
+
+Dissection = namedtuple(
+    "Dissection", "vlan ethertype src_ip dst_ip protocol src_port dst_port tos"
+)
+
+
+def _ports(hdr, off: int, protocol: int):
+    if protocol in (IPPROTO_TCP, IPPROTO_UDP, IPPROTO_SCTP) and off + 4 <= len(hdr):
+        return _PORTS.unpack_from(hdr, off)
+    return 0, 0
+
+
+def dissect_ip(hdr, off: int, ethertype: int, vlan: int = 0) -> Optional[Dissection]:
+    if ethertype == ETHERTYPE_IPV4:
+        if off + 20 > len(hdr):
+            return None
+        ihl = (hdr[off] & 0x0F) * 4
+        protocol = hdr[off + 9]
+        # only the first fragment carries the transport header
+        frag_off = ((hdr[off + 6] & 0x1F) << 8) | hdr[off + 7]
+        sport, dport = (0, 0) if frag_off else _ports(hdr, off + ihl, protocol)
+        return Dissection(
+            vlan, ethertype, bytes(hdr[off + 12 : off + 16]),
+            bytes(hdr[off + 16 : off + 20]), protocol, sport, dport, hdr[off + 1],
+        )
+    if ethertype == ETHERTYPE_IPV6:
+        if off + 40 > len(hdr):
+            return None
+        protocol = hdr[off + 6]
+        tclass = ((hdr[off] & 0x0F) << 4) | (hdr[off + 1] >> 4)
+        sport, dport = _ports(hdr, off + 40, protocol)
+        return Dissection(
+            vlan, ethertype, bytes(hdr[off + 8 : off + 24]),
+            bytes(hdr[off + 24 : off + 40]), protocol, sport, dport, tclass,
+        )
+    return Dissection(vlan, ethertype, b"", b"", 0, 0, 0, 0)
+
+
+def dissect_ethernet(hdr) -> Optional[Dissection]:
+    if len(hdr) < 14:
+        return None
+    ethertype = (hdr[12] << 8) | hdr[13]
+    off = 14
+    vlan = 0
+    while ethertype in (ETHERTYPE_VLAN, ETHERTYPE_QINQ) and off + 4 <= len(hdr):
+        # keep the innermost tag
+        vlan = ((hdr[off] << 8) | hdr[off + 1]) & 0x0FFF
+        ethertype = (hdr[off + 2] << 8) | hdr[off + 3]
+        off += 4
+    return dissect_ip(hdr, off, ethertype, vlan)
+
+
+def dissect_sampled_header(rec: sflow.SampledHeader) -> Optional[Dissection]:
+    if rec.protocol == sflow.HDR_PROTO_ETHERNET:
+        return dissect_ethernet(rec.header)
+    if rec.protocol == sflow.HDR_PROTO_IPV4:
+        return dissect_ip(rec.header, 0, ETHERTYPE_IPV4)
+    if rec.protocol == sflow.HDR_PROTO_IPV6:
+        return dissect_ip(rec.header, 0, ETHERTYPE_IPV6)
+    return None
+
+
+def dissect_flow_sample(sample: sflow.FlowSample) -> Optional[Dissection]:
+    """Build a flow key from the first usable record of a flow sample.
+
+    A raw sampled_header is preferred; sampled_ipv4/sampled_ipv6 records
+    are used when the agent exports decoded headers only. Those carry the
+    protocol and ports as u32s; a record with values that cannot occur in
+    a packet is malformed and skipped, and tos/priority keep their low
+    byte, so every key fits the fixed-width fields it is exported in.
+    """
+    for rec in sample.records:
+        data = rec.data
+        if rec.data_format == sflow.FLOW_SAMPLED_HEADER:
+            found = dissect_sampled_header(data)
+            if found is not None:
+                return found
+        elif rec.data_format in (sflow.FLOW_SAMPLED_IPV4, sflow.FLOW_SAMPLED_IPV6):
+            if data.protocol > 0xFF or max(data.src_port, data.dst_port) > 0xFFFF:
+                continue
+            if rec.data_format == sflow.FLOW_SAMPLED_IPV4:
+                ethertype, tos = ETHERTYPE_IPV4, data.tos
+            else:
+                ethertype, tos = ETHERTYPE_IPV6, data.priority
+            return Dissection(
+                0, ethertype, data.src_ip, data.dst_ip, data.protocol,
+                data.src_port, data.dst_port, tos & 0xFF,
+            )
+    return None
+
+
+def frame_length(sample: sflow.FlowSample) -> int:
+    """Original packet length reported by the first record that has one."""
+    for rec in sample.records:
+        if rec.data_format == sflow.FLOW_SAMPLED_HEADER:
+            return rec.data.frame_length
+        if rec.data_format in (sflow.FLOW_SAMPLED_IPV4, sflow.FLOW_SAMPLED_IPV6):
+            return rec.data.length
+        if rec.data_format == sflow.FLOW_SAMPLED_ETHERNET:
+            return rec.data.length
+    return 0
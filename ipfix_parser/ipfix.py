@@ -0,0 +1,299 @@
+"""IPFIX (RFC 7011) message encoding and decoding.
+
+Data records are decoded against templates learned from the same exporter.
+Fixed-length fields of up to 8 octets are returned as unsigned integers,
+everything else (addresses longer than 8 octets, strings, variable-length
+fields) as bytes.
+"""
+
+import struct
+from dataclasses import dataclass, field
+from typing import Dict, Iterable, List, Optional, Sequence, Tuple, Union
+
+IPFIX_VERSION = 10
+MESSAGE_HEADER_LEN = 16
+SET_HEADER_LEN = 4
+
+SET_ID_TEMPLATE = 2
+SET_ID_OPTIONS_TEMPLATE = 3
+SET_ID_MIN_DATA = 256
+
+VARLEN = 65535
+ENTERPRISE_BIT = 0x8000
+
+# Information Element identifiers (IANA IPFIX registry)
+IE_OCTET_DELTA_COUNT = 1
+IE_PACKET_DELTA_COUNT = 2
+IE_PROTOCOL_IDENTIFIER = 4
+IE_IP_CLASS_OF_SERVICE = 5
+IE_TCP_CONTROL_BITS = 6
+IE_SOURCE_TRANSPORT_PORT = 7
+IE_SOURCE_IPV4_ADDRESS = 8
+IE_SOURCE_IPV4_PREFIX_LENGTH = 9
+IE_INGRESS_INTERFACE = 10
+IE_DESTINATION_TRANSPORT_PORT = 11
+IE_DESTINATION_IPV4_ADDRESS = 12
+IE_DESTINATION_IPV4_PREFIX_LENGTH = 13
+IE_EGRESS_INTERFACE = 14
+IE_IP_NEXT_HOP_IPV4_ADDRESS = 15
+IE_BGP_SOURCE_AS_NUMBER = 16
+IE_BGP_DESTINATION_AS_NUMBER = 17
+IE_SOURCE_IPV6_ADDRESS = 27
+IE_DESTINATION_IPV6_ADDRESS = 28
+IE_APPLICATION_NAME = 96
+IE_FLOW_START_MILLISECONDS = 152
+IE_FLOW_END_MILLISECONDS = 153
+
+_MESSAGE_HEADER = struct.Struct("!HHIII")
+_SET_HEADER = struct.Struct("!HH")
+_U16 = struct.Struct("!H")
+_U16X2 = struct.Struct("!HH")
+_U32 = struct.Struct("!I")
+
+Value = Union[int, bytes]
+
+
+class DecodeError(ValueError):
+    pass
+
+
+@dataclass(frozen=True)
+class FieldSpec:
+    ie: int
+    length: int
+    enterprise: int = 0
+
+
+@dataclass
+class Template:
+    template_id: int
+    fields: Tuple[FieldSpec, ...]
+    scope_count: int = 0  # non-zero for options templates
+
+    @property
+    def fixed_length(self) -> Optional[int]:
+        """Record length when no field is variable length, else None."""
+        if any(f.length == VARLEN for f in self.fields):
+            return None
+        return sum(f.length for f in self.fields)
+
+    @property
+    def min_length(self) -> int:
+        return sum(1 if f.length == VARLEN else f.length for f in self.fields)
+
+
+@dataclass
+class MessageHeader:
+    version: int
+    length: int
+    export_time: int
+    sequence_number: int
+    domain_id: int
+
+
+@dataclass
+class DataRecord:
+    template: Template
+    values: List[Value]
+
+
+@dataclass
+class Message:
+    header: MessageHeader
+    templates: List[Template] = field(default_factory=list)
+    records: List[DataRecord] = field(default_factory=list)
+    # data sets referencing a template not (yet) learned
+    unknown_sets: int = 0
+
+
+class TemplateCache:
+    """Templates learned from one exporter, keyed by (domain_id, template_id)."""
+
+    def __init__(self) -> None:
+        self.templates: Dict[Tuple[int, int], Template] = {}
+
+    def __len__(self) -> int:
+        return len(self.templates)
+
+    def get(self, domain_id: int, template_id: int) -> Optional[Template]:
+        return self.templates.get((domain_id, template_id))
+
+    def add(self, domain_id: int, template: Template) -> None:
+        if template.fields:
+            self.templates[(domain_id, template.template_id)] = template
+        else:
+            # a template record with no fields withdraws the template
+            self.templates.pop((domain_id, template.template_id), None)
+
+
+def decode_message_header(buf, off: int = 0) -> MessageHeader:
+    if len(buf) - off < MESSAGE_HEADER_LEN:
+        raise DecodeError("truncated IPFIX message header")
+    hdr = MessageHeader(*_MESSAGE_HEADER.unpack_from(buf, off))
+    if hdr.version != IPFIX_VERSION:
+        raise DecodeError(f"unsupported IPFIX version: {hdr.version}")
+    if hdr.length < MESSAGE_HEADER_LEN:
+        raise DecodeError(f"bad IPFIX message length: {hdr.length}")
+    return hdr
+
+
+def _decode_templates(buf, off: int, end: int, options: bool) -> List[Template]:
+    templates = []
+    # anything shorter than a template record header is set padding
+    while end - off >= 4:
+        template_id, count = _U16X2.unpack_from(buf, off)
+        off += 4
+        scope_count = 0
+        if options:
+            if end - off < 2:
+                raise DecodeError("truncated options template record")
+            scope_count = _U16.unpack_from(buf, off)[0]
+            off += 2
+        fields = []
+        for _ in range(count):
+            if end - off < 4:
+                raise DecodeError("truncated template field")
+            ie, length = _U16X2.unpack_from(buf, off)
+            off += 4
+            enterprise = 0
+            if ie & ENTERPRISE_BIT:
+                if end - off < 4:
+                    raise DecodeError("truncated enterprise number")
+                enterprise = _U32.unpack_from(buf, off)[0]
+                off += 4
+                ie &= ~ENTERPRISE_BIT
+            fields.append(FieldSpec(ie, length, enterprise))
+        templates.append(Template(template_id, tuple(fields), scope_count))
+    return templates
+
+
+def decode_data_records(
+    template: Template, buf, off: int, end: int
+) -> List[List[Value]]:
+    rows = []
+    min_length = template.min_length
+    # a zero-length template cannot be told apart from padding
+    if min_length == 0:
+        return rows
+    while end - off >= min_length:
+        row = []
+        for f in template.fields:
+            length = f.length
+            if length == VARLEN:
+                if off >= end:
+                    raise DecodeError("variable-length field overruns set")
+                length = buf[off]
+                off += 1
+                if length == 255:
+                    if off + 2 > end:
+                        raise DecodeError("variable-length field overruns set")
+                    length = _U16.unpack_from(buf, off)[0]
+                    off += 2
+                if off + length > end:
+                    raise DecodeError("variable-length field overruns set")
+                row.append(bytes(buf[off : off + length]))
+            elif off + length > end:
+                raise DecodeError(f"field {f.ie} overruns set")
+            elif length <= 8:
+                row.append(int.from_bytes(buf[off : off + length], "big"))
+            else:
+                row.append(bytes(buf[off : off + length]))
+            off += length
+        rows.append(row)
+    return rows
+
+
+def decode_message(buf, cache: TemplateCache, off: int = 0) -> Message:
+    """Decode one IPFIX message starting at buf[off], learning templates
+    into `cache` before decoding the data sets that follow them."""
+    hdr = decode_message_header(buf, off)
+    end = off + hdr.length
+    if end > len(buf):
+        raise DecodeError(f"IPFIX message length {hdr.length} exceeds buffer")
+    msg = Message(hdr)
+    off += MESSAGE_HEADER_LEN
+    while off < end:
+        if end - off < SET_HEADER_LEN:
+            raise DecodeError("truncated set header")
+        set_id, set_len = _SET_HEADER.unpack_from(buf, off)
+        if set_len < SET_HEADER_LEN or off + set_len > end:
+            raise DecodeError(f"bad set length {set_len} for set {set_id}")
+        body, set_end = off + SET_HEADER_LEN, off + set_len
+        if set_id in (SET_ID_TEMPLATE, SET_ID_OPTIONS_TEMPLATE):
+            options = set_id == SET_ID_OPTIONS_TEMPLATE
+            for template in _decode_templates(buf, body, set_end, options):
+                cache.add(hdr.domain_id, template)
+                msg.templates.append(template)
+        elif set_id >= SET_ID_MIN_DATA:
+            template = cache.get(hdr.domain_id, set_id)
+            if template is None:
+                msg.unknown_sets += 1
+            else:
+                for row in decode_data_records(template, buf, body, set_end):
+                    msg.records.append(DataRecord(template, row))
+        off = set_end
+    return msg
+
+
+# -- encoding ----------------------------------------------------------------
+
+
+def encode_message_header(
+    length: int, export_time: int, sequence_number: int, domain_id: int
+) -> bytes:
+    return _MESSAGE_HEADER.pack(
+        IPFIX_VERSION, length, export_time, sequence_number, domain_id
+    )
+
+
+def encode_template_record(template: Template) -> bytes:
+    out = [_U16X2.pack(template.template_id, len(template.fields))]
+    if template.scope_count:
+        out.append(_U16.pack(template.scope_count))
+    for f in template.fields:
+        if f.enterprise:
+            out.append(_U16X2.pack(f.ie | ENTERPRISE_BIT, f.length))
+            out.append(_U32.pack(f.enterprise))
+        else:
+            out.append(_U16X2.pack(f.ie, f.length))
+    return b"".join(out)
+
+
+def encode_set(set_id: int, body: bytes) -> bytes:
+    return _SET_HEADER.pack(set_id, SET_HEADER_LEN + len(body)) + body
+
+
+def encode_template_set(templates: Sequence[Template]) -> bytes:
+    options = bool(templates) and templates[0].scope_count > 0
+    set_id = SET_ID_OPTIONS_TEMPLATE if options else SET_ID_TEMPLATE
+    return encode_set(set_id, b"".join(encode_template_record(t) for t in templates))
+
+
+def encode_value(spec: FieldSpec, value: Value) -> bytes:
+    if spec.length == VARLEN:
+        data = bytes(value)
+        if len(data) < 255:
+            return bytes((len(data),)) + data
+        return b"\xff" + _U16.pack(len(data)) + data
+    if isinstance(value, int):
+        return value.to_bytes(spec.length, "big")
+    if len(value) != spec.length:
+        raise ValueError(f"IE {spec.ie} needs {spec.length} bytes, got {len(value)}")
+    return bytes(value)
+
+
+def encode_data_record(template: Template, values: Sequence[Value]) -> bytes:
+    return b"".join(encode_value(f, v) for f, v in zip(template.fields, values))
+
+
+def encode_data_set(template: Template, rows: Iterable[Sequence[Value]]) -> bytes:
+    body = b"".join(encode_data_record(template, row) for row in rows)
+    return encode_set(template.template_id, body)
+
+
+def encode_message(
+    sets: Sequence[bytes], export_time: int, sequence_number: int, domain_id: int
+) -> bytes:
+    length = MESSAGE_HEADER_LEN + sum(len(s) for s in sets)
+    hdr = encode_message_header(length, export_time, sequence_number, domain_id)
+    return hdr + b"".join(sets)
@@ -0,0 +1,751 @@
+"""Staged sFlow collector pipeline.
+
+    receive -> decode -> dissect -> aggregate -> export
+
+Stages run on their own threads and are joined by bounded rings that
+carry batches (lists) rather than single records, so a slow exporter can
+no longer stall the socket. When a ring downstream of the decoder fills
+up, whole flow samples are shed before they enter it and the survivors
+have their sampling_rate scaled by the shed factor. Byte and packet
+estimates (frame_length * sampling_rate) therefore stay unbiased while
+the pipeline is overloaded. Counter samples are never shed: they are
+absolute values, not estimates, and losing them would corrupt deltas.
+
+The decoder sheds its own input the same way, so a backed up raw ring
+degrades estimates rather than dropping whole datagrams. While that ring
+fills, each datagram is decoded in full with probability 1/`factor`, its
+flow samples reweighted; the others are only walked for their counter
+samples.
+
+With a checkpoint path the long-lived tables (agent sequence baselines,
+last if_counters, the open window, learned IPFIX templates) are
+snapshotted periodically and on stop(); restore() loads them back before
+start(). See ipfix_parser.checkpoint.
+"""
+import argparse
+import copy
+import os
+import random
+import select
+import socket
+import struct
+import sys
+import threading
+import time
+from collections import deque
+from dataclasses import dataclass, fields
+from typing import Callable, Dict, List, Optional, Sequence, Tuple
+
+from ipfix_parser import dissect, sflow
+from ipfix_parser.checkpoint import (
+    CowTable,
+    Snapshot,
+    encode_snapshot,
+    read_snapshot,
+    write_snapshot,
+)
+from ipfix_parser.ipfix import TemplateCache
+from ipfix_parser.replicator import (
+    Parsed,
+    ReplicationTarget,
+    Replicator,
+    parse_target,
+)
+from ipfix_parser.translate import IpfixTranslator, socket_sink
+from ipfix_parser.tsstore import CounterStore
+
+DEFAULT_RING_CAPACITY = 256  # batches
+DEFAULT_BATCH_SIZE = 64  # datagrams per receive batch
+DEFAULT_WINDOW = 10.0  # aggregation window, seconds
+DEFAULT_CHECKPOINT_INTERVAL = 30.0  # seconds
+
+_IDLE_WAIT = 0.05
+
+
+@dataclass
+class AgentSample:
+    """A decoded sample tagged with the agent that exported it."""
+
+    agent_address: bytes
+    sample: sflow.Sample
+    key: Optional[dissect.Dissection] = None
+
+
+class Ring:
+    """Bounded FIFO of batches between two pipeline stages.
+
+    A single producer / single consumer ring needs no lock: deque.append()
+    and deque.popleft() are atomic, and only the producer ever grows the
+    ring so its capacity check cannot race. With multi_producer=True the
+    producers serialise on a lock between the check and the append.
+    """
+
+    def __init__(
+        self, capacity: int = DEFAULT_RING_CAPACITY, multi_producer: bool = False
+    ) -> None:
+        if capacity < 1:
+            raise ValueError("ring capacity must be positive")
+        self.capacity = capacity
+        self._items: deque = deque()
+        self._lock = threading.Lock() if multi_producer else None
+        self._not_empty = threading.Event()
+        self._not_full = threading.Event()
+        self._not_full.set()
+        self.high_water = 0
+
+    def __len__(self) -> int:
+        return len(self._items)
+
+    def fill(self) -> float:
+        return len(self._items) / self.capacity
+
+    def _push(self, batch: list) -> bool:
+        if len(self._items) >= self.capacity:
+            self._not_full.clear()
+            return False
+        self._items.append(batch)
+        depth = len(self._items)
+        if depth > self.high_water:
+            self.high_water = depth
+        self._not_empty.set()
+        return True
+
+    def try_push(self, batch: list) -> bool:
+        if self._lock is None:
+            return self._push(batch)
+        with self._lock:
+            return self._push(batch)
+
+    def push(self, batch: list) -> None:
+        """Push, waiting for the consumer to make space."""
+        while not self.try_push(batch):
+            self._not_full.wait(_IDLE_WAIT)
+
+    def try_pop(self) -> Optional[list]:
+        try:
+            batch = self._items.popleft()
+        except IndexError:
+            self._not_empty.clear()
+            return None
+        self._not_full.set()
+        return batch
+
+    def wait(self, timeout: float = _IDLE_WAIT) -> None:
+        self._not_empty.wait(timeout)
+
+
+class LoadShedder:
+    """Weighted random thinning of flow samples.
+
+    Keeps each sample with probability 1/`factor` and multiplies the
+    sampling_rate of each survivor by `factor`. The decision is random
+    rather than one-in-N so that a regular pattern in the input (agents
+    interleaved datagram by datagram, say) cannot line up with it and
+    bias the estimate of any one flow. The factor doubles while the
+    watched ring is above `high` and halves once it drains below `low`.
+    """
+
+    def __init__(
+        self,
+        high: float = 0.75,
+        low: float = 0.25,
+        max_factor: int = 256,
+        seed: Optional[int] = None,
+    ) -> None:
+        self.high = high
+        self.low = low
+        self.max_factor = max_factor
+        self.factor = 1
+        self._random = random.Random(seed).random
+
+    def keep(self) -> bool:
+        """True with probability 1/`factor`."""
+        return self._random() * self.factor < 1.0
+
+    def update(self, fill: float) -> int:
+        if fill >= self.high and self.factor < self.max_factor:
+            self.factor *= 2
+        elif fill <= self.low and self.factor > 1:
+            self.factor //= 2
+        return self.factor
+
+    def apply(self, items: List[AgentSample]) -> Tuple[List[AgentSample], int]:
+        """Return (survivors, number shed). Non flow samples always survive."""
+        factor = self.factor
+        if factor == 1:
+            return items, 0
+        kept = []
+        shed = 0
+        for item in items:
+            sample = item.sample
+            if not isinstance(sample, sflow.FlowSample):
+                kept.append(item)
+                continue
+            if self.keep():
+                sample.sampling_rate *= factor
+                kept.append(item)
+            else:
+                shed += 1
+        return kept, shed
+
+
+@dataclass
+class PipelineMetrics:
+    datagrams_received: int = 0
+    datagrams_dropped: int = 0
+    datagrams_shed: int = 0  # only their counter samples were decoded
+    datagrams_decoded: int = 0
+    datagrams_lost: int = 0  # gaps in agent sequence numbers
+    decode_errors: int = 0
+    flow_samples: int = 0
+    counter_samples: int = 0
+    counter_discontinuities: int = 0  # if_counters that went backwards
+    samples_shed: int = 0
+    shed_batches: int = 0
+    shed_factor: int = 1
+    max_shed_factor: int = 1
+    flows_exported: int = 0
+    windows_exported: int = 0
+    checkpoints: int = 0
+    checkpoint_errors: int = 0
+
+    def snapshot(self) -> Dict[str, int]:
+        return {f.name: getattr(self, f.name) for f in fields(self)}
+
+
+@dataclass
+class FlowAggregate:
+    agent_address: bytes
+    input: int
+    output: int
+    key: dissect.Dissection
+    bytes: int = 0
+    packets: int = 0
+    samples: int = 0
+
+
+def print_exporter(window: List[FlowAggregate]) -> None:
+    for agg in window:
+        print(
+            f"agent: {agg.agent_address.hex()} in: {agg.input} out: {agg.output} "
+            f"key: {agg.key} bytes: {agg.bytes} packets: {agg.packets}"
+        )
+
+
+def _decode_counters_only(data: bytes, dgram: sflow.Datagram, bounds) -> int:
+    """Decode every sample but the flow samples into dgram; returns the
+    number of flow samples skipped."""
+    skipped = 0
+    for fmt, start, end in bounds:
+        if fmt == sflow.SAMPLE_FLOW:
+            skipped += 1
+        else:
+            dgram.samples.append(sflow.decode_sample(fmt, data, start, end))
+    return skipped
+
+
+class Pipeline:
+    """Owns the rings and stage threads of one collector instance."""
+
+    def __init__(
+        self,
+        exporter: Callable[[List[FlowAggregate]], None] = print_exporter,
+        counters_sink: Optional[Callable[[List[AgentSample]], None]] = None,
+        ring_capacity: int = DEFAULT_RING_CAPACITY,
+        window: float = DEFAULT_WINDOW,
+        receivers: int = 1,
+        replicator: Optional[Replicator] = None,
+        translator: Optional[IpfixTranslator] = None,
+        checkpoint_path: Optional[str] = None,
+        checkpoint_interval: float = DEFAULT_CHECKPOINT_INTERVAL,
+        seed: Optional[int] = None,
+    ) -> None:
+        self.exporter = exporter
+        self.replicator = replicator
+        self.translator = translator
+        self.counters_sink = counters_sink
+        self.window = window
+        self.metrics = PipelineMetrics()
+        self.raw_ring = Ring(ring_capacity, multi_producer=receivers > 1)
+        self.decoded_ring = Ring(ring_capacity)
+        self.dissected_ring = Ring(ring_capacity)
+        self.export_ring = Ring(ring_capacity)
+        # one generator per shedder, each used by a single stage
+        self.rng = random.Random(seed)
+        self.raw_shedder = LoadShedder(seed=self.rng.getrandbits(64))
+        self.decode_shedder = LoadShedder(seed=self.rng.getrandbits(64))
+        self.dissect_shedder = LoadShedder(seed=self.rng.getrandbits(64))
+        self._stop = threading.Event()
+        self._threads: List[threading.Thread] = []
+        self.checkpoint_path = checkpoint_path
+        self.checkpoint_interval = checkpoint_interval
+        self._epoch = 0
+        self._checkpoint_lock = threading.Lock()
+        # shed counters are updated from more than one stage
+        self._metrics_lock = threading.Lock()
+        # owned by the decode stage
+        self.agent_sequences = CowTable()  # (agent, sub_agent_id) -> seq
+        # owned by the aggregate stage
+        self.if_counters = CowTable()  # (agent, source_id) -> IfCounters
+        self._flows = CowTable(copy=copy.copy)
+        # exporter name -> TemplateCache, for IPFIX inputs
+        self.template_caches: Dict[str, TemplateCache] = {}
+        self._window_start = time.monotonic()
+        self._window_age = 0.0  # carried over from a restored snapshot
+
+    # -- stage bodies ------------------------------------------------------
+
+    def _shed(
+        self, shedder: LoadShedder, ring: Ring, items: List[AgentSample]
+    ) -> List[AgentSample]:
+        factor = shedder.update(ring.fill())
+        kept, shed = shedder.apply(items)
+        m = self.metrics
+        with self._metrics_lock:
+            self._count_factor(factor)
+            if shed:
+                m.samples_shed += shed
+                m.shed_batches += 1
+        return kept
+
+    def _count_factor(self, factor: int) -> None:
+        """Caller holds _metrics_lock."""
+        m = self.metrics
+        m.shed_factor = max(
+            self.raw_shedder.factor,
+            self.decode_shedder.factor,
+            self.dissect_shedder.factor,
+        )
+        if factor > m.max_shed_factor:
+            m.max_shed_factor = factor
+
+    def decode_batch(
+        self,
+        batch: List[Tuple[bytes, tuple]],
+        shedder: Optional[LoadShedder] = None,
+        parsed: Optional[List[Optional[Parsed]]] = None,
+    ) -> List[AgentSample]:
+        """Decode a batch of (datagram, peer).
+
+        `parsed` is what Replicator.forward() returned for the batch, so
+        headers and sample bounds it already read are not read again. With
+        a shedder above factor 1, only the datagrams it keeps are decoded
+        in full, their flow samples scaled by the factor; the rest have
+        their flow samples skipped.
+        """
+        out = []
+        m = self.metrics
+        m.datagrams_decoded += len(batch)
+        factor = 1 if shedder is None else shedder.factor
+        shed_datagrams = shed = 0
+        for i, (data, _addr) in enumerate(batch):
+            try:
+                known = None if parsed is None else parsed[i]
+                if known is None:
+                    dgram = sflow.decode_header(data)
+                    bounds = sflow.iter_sample_bounds(data, dgram)
+                else:
+                    dgram, bounds = known
+                if factor == 1 or shedder.keep():
+                    dgram.samples = [
+                        sflow.decode_sample(fmt, data, start, end)
+                        for fmt, start, end in bounds
+                    ]
+                else:
+                    shed += _decode_counters_only(data, dgram, bounds)
+                    shed_datagrams += 1
+            except sflow.DecodeError:
+                m.decode_errors += 1
+                continue
+            self._collect(dgram, factor, out)
+        if shed_datagrams:
+            m.datagrams_shed += shed_datagrams
+            m.flow_samples += shed
+            with self._metrics_lock:
+                m.samples_shed += shed
+                m.shed_batches += 1
+        return out
+
+    def _collect(
+        self, dgram: sflow.Datagram, factor: int, out: List[AgentSample]
+    ) -> None:
+        m = self.metrics
+        key = (dgram.agent_address, dgram.sub_agent_id)
+        last = self.agent_sequences.get(key)
+        if last is not None and dgram.sequence_number > last + 1:
+            m.datagrams_lost += dgram.sequence_number - last - 1
+        # a lower number means the agent restarted: rebaseline
+        self.agent_sequences[key] = dgram.sequence_number
+        for sample in dgram.samples:
+            if isinstance(sample, sflow.FlowSample):
+                m.flow_samples += 1
+                sample.sampling_rate *= factor
+            elif isinstance(sample, sflow.CountersSample):
+                m.counter_samples += 1
+            out.append(AgentSample(dgram.agent_address, sample))
+
+    def dissect_batch(self, batch: List[AgentSample]) -> List[AgentSample]:
+        for item in batch:
+            if isinstance(item.sample, sflow.FlowSample):
+                item.key = dissect.dissect_flow_sample(item.sample)
+        return batch
+
+    def aggregate_batch(self, batch: List[AgentSample]) -> None:
+        if self.translator is not None:
+            # after shedding, so translated counts carry the scaled rates
+            self.translator.translate(batch)
+        counters = []
+        for item in batch:
+            sample = item.sample
+            if isinstance(sample, sflow.CountersSample):
+                counters.append(item)
+                self._track_if_counters(item.agent_address, sample)
+                continue
+            if not isinstance(sample, sflow.FlowSample) or item.key is None:
+                continue
+            k = (item.agent_address, sample.input, sample.output, item.key)
+            agg = self._flows.get(k)
+            if agg is None:
+                agg = FlowAggregate(
+                    item.agent_address, sample.input, sample.output, item.key
+                )
+                self._flows[k] = agg
+            agg.bytes += dissect.frame_length(sample) * sample.sampling_rate
+            agg.packets += sample.sampling_rate
+            agg.samples += 1
+        if counters and self.counters_sink is not None:
+            self.counters_sink(counters)
+
+    def _track_if_counters(
+        self, agent_address: bytes, sample: sflow.CountersSample
+    ) -> None:
+        cur = sample.record(sflow.COUNTERS_IF)
+        if cur is None or isinstance(cur, bytes):
+            return
+        key = (agent_address, sample.source_id)
+        prev = self.if_counters.get(key)
+        if prev is not None and (
+            cur.in_octets < prev.in_octets or cur.out_octets < prev.out_octets
+        ):
+            self.metrics.counter_discontinuities += 1
+        self.if_counters[key] = cur
+
+    def flush_window(self) -> List[FlowAggregate]:
+        if self.translator is not None:
+            self.translator.flush()
+        window = list(self._flows.values())
+        self._flows.clear()
+        self._window_start = time.monotonic()
+        return window
+
+    # -- threads -----------------------------------------------------------
+
+    def _decode_loop(self) -> None:
+        while True:
+            self.agent_sequences.poll()
+            item = self.raw_ring.try_pop()
+            if item is None:
+                if self._drained(self.raw_ring, -1):
+                    break
+                self.raw_ring.wait()
+                continue
+            batch, parsed = item
+            factor = self.raw_shedder.update(self.raw_ring.fill())
+            with self._metrics_lock:
+                self._count_factor(factor)
+            samples = self.decode_batch(batch, self.raw_shedder, parsed)
+            samples = self._shed(self.decode_shedder, self.decoded_ring, samples)
+            if samples:
+                self.decoded_ring.push(samples)
+
+    def _dissect_loop(self) -> None:
+        while True:
+            batch = self.decoded_ring.try_pop()
+            if batch is None:
+                if self._drained(self.decoded_ring, 0):
+                    break
+                self.decoded_ring.wait()
+                continue
+            batch = self._shed(self.dissect_shedder, self.dissected_ring, batch)
+            if batch:
+                self.dissected_ring.push(self.dissect_batch(batch))
+
+    def _aggregate_loop(self) -> None:
+        while True:
+            self.if_counters.poll()
+            self._flows.poll()
+            batch = self.dissected_ring.try_pop()
+            if batch is not None:
+                self.aggregate_batch(batch)
+            elif self._drained(self.dissected_ring, 1):
+                break
+            else:
+                self.dissected_ring.wait()
+            if self.translator is not None:
+                self.translator.poll()
+            if time.monotonic() - self._window_start >= self.window:
+                self.export_ring.push(self.flush_window())
+        window = self.flush_window()
+        if window:
+            # the export stage drains until this thread has exited
+            self.export_ring.push(window)
+
+    def _export_loop(self) -> None:
+        while True:
+            window = self.export_ring.try_pop()
+            if window is None:
+                if self._drained(self.export_ring, 2):
+                    break
+                self.export_ring.wait()
+                continue
+            self.exporter(window)
+            self.metrics.flows_exported += len(window)
+            self.metrics.windows_exported += 1
+
+    def _checkpoint_loop(self) -> None:
+        while not self._stop.wait(self.checkpoint_interval):
+            self._try_checkpoint()
+
+    def _try_checkpoint(self) -> None:
+        """A failed checkpoint is counted; the previous snapshot stays in
+        place and the next interval tries again."""
+        try:
+            self.checkpoint()
+        except (OSError, struct.error):
+            self.metrics.checkpoint_errors += 1
+
+    def _drained(self, ring: Ring, upstream: int) -> bool:
+        """True once stop() was called, the upstream stage has exited and
+        nothing is left in `ring`. Checked in that order so a final batch
+        pushed just before the upstream thread exits is never missed."""
+        if not self._stop.is_set():
+            return False
+        if upstream >= 0 and self._threads[upstream].is_alive():
+            return False
+        return len(ring) == 0
+
+    def start(self) -> None:
+        self._stop.clear()
+        self._window_start = time.monotonic() - self._window_age
+        self._window_age = 0.0
+        stages = [
+            self._decode_loop,
+            self._dissect_loop,
+            self._aggregate_loop,
+            self._export_loop,
+        ]
+        if self.checkpoint_path is not None:
+            stages.append(self._checkpoint_loop)
+        for target in stages:
+            name = target.__name__.strip("_")
+            t = threading.Thread(target=target, name=name, daemon=True)
+            t.start()
+            self._threads.append(t)
+
+    def stop(self) -> None:
+        """Stop accepting input, drain every stage and flush the open window."""
+        self._stop.set()
+        for t in self._threads:
+            t.join()
+        self._threads = []
+        if self.checkpoint_path is not None:
+            self._try_checkpoint()
+
+    # -- checkpoints -------------------------------------------------------
+
+    def _owner_alive(self, stage: int) -> bool:
+        return stage < len(self._threads) and self._threads[stage].is_alive()
+
+    def checkpoint(self, path: Optional[str] = None) -> int:
+        """Snapshot the long-lived tables to `path`; returns its size.
+
+        Safe while the stages run: each table is frozen by its owning stage
+        between two batches and thawed once the file is written, so no
+        stage waits on the disk. Tables of a stage that is not running are
+        frozen here instead.
+        """
+        with self._checkpoint_lock:
+            path = path or self.checkpoint_path
+            owned = (
+                (self.agent_sequences, 0),
+                (self.if_counters, 2),
+                (self._flows, 2),
+            )
+            for table, _ in owned:
+                table.request_freeze()
+            try:
+                for table, stage in owned:
+                    while not table.wait_frozen(_IDLE_WAIT):
+                        if not self._owner_alive(stage):
+                            table.poll()
+                self._epoch += 1
+                age = time.monotonic() - self._window_start
+                data = encode_snapshot(
+                    self._epoch,
+                    self.agent_sequences.frozen,
+                    self.if_counters.frozen,
+                    self._flows.frozen.values(),
+                    int((time.time() - age) * 1000),
+                    self.translator.sequence_number if self.translator else 0,
+                    self.template_caches,
+                )
+                write_snapshot(path, data)
+            finally:
+                for table, stage in owned:
+                    table.release()
+                    if not self._owner_alive(stage):
+                        table.poll()
+            self.metrics.checkpoints += 1
+        return len(data)
+
+    def restore(self, path: Optional[str] = None) -> Snapshot:
+        """Load a snapshot written by checkpoint(). Call before start()."""
+        snap = read_snapshot(path or self.checkpoint_path)
+        self._epoch = snap.epoch
+        self.agent_sequences.update(snap.agent_sequences)
+        self.if_counters.update(snap.if_counters)
+        for row in snap.flows:
+            agg = FlowAggregate(*row)
+            self._flows[(agg.agent_address, agg.input, agg.output, agg.key)] = agg
+        # the restored window closes no later than it would have originally
+        age = time.time() - snap.window_start_ms / 1000
+        self._window_age = min(max(age, 0.0), self.window)
+        if self.translator is not None:
+            self.translator.sequence_number = snap.export_sequence
+        self.template_caches.update(snap.templates)
+        return snap
+
+    def submit(self, batch: List[Tuple[bytes, tuple]]) -> bool:
+        """Hand a batch of (datagram, peer) to the decoder without blocking.
+
+        The batch is replicated first, so targets get it even when it is
+        dropped here, and whatever the target filters parsed rides along
+        with it for the decoder. The decoder sheds flow samples as this
+        ring fills; a full ring means it is behind even so, and the batch
+        is dropped.
+        """
+        self.metrics.datagrams_received += len(batch)
+        parsed = None
+        if self.replicator is not None:
+            parsed = self.replicator.forward(batch)
+        if self.raw_ring.try_push((batch, parsed)):
+            return True
+        self.metrics.datagrams_dropped += len(batch)
+        return False
+
+    def receive(
+        self, sock: socket.socket, batch_size: int = DEFAULT_BATCH_SIZE
+    ) -> None:
+        """Receive stage: read datagrams into batches until stop()."""
+        sock.setblocking(False)
+        while not self._stop.is_set():
+            readable, _, _ = select.select([sock], [], [], _IDLE_WAIT)
+            if not readable:
+                continue
+            batch = []
+            try:
+                while len(batch) < batch_size:
+                    batch.append(sock.recvfrom(0xFFFF))
+            except BlockingIOError:
+                pass
+            if batch:
+                self.submit(batch)
+
+
+def run(
+    host: str = "0.0.0.0",
+    port: int = 6343,
+    forward_to: Sequence[ReplicationTarget] = (),
+    translate_to: Optional[Tuple[str, int]] = None,
+    store_path: Optional[str] = None,
+    checkpoint_path: Optional[str] = None,
+) -> int:
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((host, port))
+    rep = None
+    if forward_to:
+        rep = Replicator(forward_to)
+        rep.open()
+    translator = None
+    if translate_to is not None:
+        ipfix_sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        ipfix_sock.connect(translate_to)
+        translator = IpfixTranslator(socket_sink(ipfix_sock))
+    store = None
+    counters_sink = None
+    if store_path is not None:
+        store = CounterStore(store_path)
+        counters_sink = store.ingest_samples
+    pipeline = Pipeline(
+        counters_sink=counters_sink,
+        replicator=rep,
+        translator=translator,
+        checkpoint_path=checkpoint_path,
+    )
+    if checkpoint_path is not None and os.path.exists(checkpoint_path):
+        snap = pipeline.restore()
+        print(f"restored checkpoint epoch {snap.epoch}")
+    pipeline.start()
+    try:
+        pipeline.receive(sock)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        pipeline.stop()
+        print(pipeline.metrics.snapshot())
+        if rep is not None:
+            rep.close()
+            print(rep.stats())
+        if translator is not None:
+            print(translator.stats.snapshot())
+        if store is not None:
+            store.close()
+            print(store.stats)
+    return 0
+
+
+def _host_port(arg: str) -> Tuple[str, int]:
+    host, port = arg.rsplit(":", 1)
+    return host, int(port)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="sFlow collector pipeline",
+        epilog="e.g. forward everything to one consumer, counters only to "
+        "another and one agent's flows to a third: "
+        "10.0.0.5:6343 10.0.0.6:6343,sample_format=2 "
+        "10.0.0.7:6343,agent=192.0.2.1,sample_format=1",
+    )
+    parser.add_argument(
+        "targets",
+        nargs="*",
+        type=parse_target,
+        metavar="host:port[,key=value...]",
+        help="replicate the raw datagrams to each target, optionally only "
+        "those matching agent=, source_id=, sample_format= and "
+        "record_format= (keys may repeat)",
+    )
+    parser.add_argument(
+        "--ipfix",
+        type=_host_port,
+        metavar="host:port",
+        help="translate samples to IPFIX and send them here",
+    )
+    parser.add_argument(
+        "--store", metavar="PATH", help="keep counters in a time-series store"
+    )
+    parser.add_argument(
+        "--checkpoint",
+        metavar="PATH",
+        help="snapshot collector state here and resume from it",
+    )
+    args = parser.parse_args()
+    sys.exit(
+        run(
+            forward_to=args.targets,
+            translate_to=args.ipfix,
+            store_path=args.store,
+            checkpoint_path=args.checkpoint,
+        )
+    )
@@ -0,0 +1,374 @@
+"""sFlow datagram replication.
+
+Forwards the original datagram bytes, untouched, to any number of UDP
+targets. The pipeline replicates as datagrams are received, before they
+are queued for decoding, so targets see the full stream however far the
+decoder falls behind. Each target may carry a filter on agent address,
+source_id, sample format or record format; filters are evaluated against
+a summary built from the datagram header and sample bounds (see
+summarize()), never a full decode. forward() hands that parse back to
+the caller, and the pipeline's decoder continues from it instead of
+reading the header and sample bounds again. Datagrams are sent per
+target in batches with sendmmsg(2) when libc provides it, falling back to
+one send() per datagram otherwise.
+"""
+
+import ctypes
+import ctypes.util
+import errno
+import ipaddress
+import socket
+import struct
+import threading
+from dataclasses import dataclass, field, fields
+from typing import (
+    Dict,
+    FrozenSet,
+    Iterable,
+    List,
+    NamedTuple,
+    Optional,
+    Sequence,
+    Tuple,
+)
+
+from ipfix_parser import sflow
+
+MAX_BATCH = 1024
+
+
+class _IoVec(ctypes.Structure):
+    _fields_ = [("iov_base", ctypes.c_void_p), ("iov_len", ctypes.c_size_t)]
+
+
+class _MsgHdr(ctypes.Structure):
+    _fields_ = [
+        ("msg_name", ctypes.c_void_p),
+        ("msg_namelen", ctypes.c_uint32),
+        ("msg_iov", ctypes.POINTER(_IoVec)),
+        ("msg_iovlen", ctypes.c_size_t),
+        ("msg_control", ctypes.c_void_p),
+        ("msg_controllen", ctypes.c_size_t),
+        ("msg_flags", ctypes.c_int),
+    ]
+
+
+class _MMsgHdr(ctypes.Structure):
+    _fields_ = [("msg_hdr", _MsgHdr), ("msg_len", ctypes.c_uint)]
+
+
+def _load_sendmmsg():
+    try:
+        libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+        fn = libc.sendmmsg
+    except (OSError, AttributeError, TypeError):
+        return None
+    fn.argtypes = [ctypes.c_int, ctypes.c_void_p, ctypes.c_uint, ctypes.c_int]
+    fn.restype = ctypes.c_int
+    return fn
+
+
+_sendmmsg = _load_sendmmsg()
+
+_U32 = struct.Struct("!I")
+
+# (data_format, start, end) of each sample_record, as iter_sample_bounds()
+SampleBounds = List[Tuple[int, int, int]]
+Parsed = Tuple[sflow.Datagram, SampleBounds]
+
+
+class DatagramSummary(NamedTuple):
+    """What target filters look at, read without decoding any sample."""
+
+    agent_address: bytes
+    source_ids: FrozenSet[int]
+    sample_formats: FrozenSet[int]
+    record_formats: FrozenSet[int]  # flow and counter record formats
+
+
+def parse_bounds(data) -> Optional[Parsed]:
+    """Decode the header of a raw datagram and locate its samples, or
+    return None if either fails."""
+    try:
+        dgram = sflow.decode_header(data)
+        return dgram, list(sflow.iter_sample_bounds(data, dgram))
+    except sflow.DecodeError:
+        return None
+
+
+def summarize(
+    data, records: bool = True, parsed: Optional[Parsed] = None
+) -> Optional[DatagramSummary]:
+    """Summarise a raw datagram from its header and sample bounds, or
+    return None if it does not parse. `parsed` is parse_bounds(data) when
+    the caller has it already. The source_id is the second word of a flow
+    or counters sample body; record formats are only collected with
+    `records`."""
+    if parsed is None:
+        parsed = parse_bounds(data)
+        if parsed is None:
+            return None
+    dgram, bounds = parsed
+    try:
+        source_ids = set()
+        sample_formats = set()
+        record_formats = set()
+        for fmt, start, end in bounds:
+            sample_formats.add(fmt)
+            if fmt not in (sflow.SAMPLE_FLOW, sflow.SAMPLE_COUNTERS):
+                continue
+            if end - start < 8:
+                raise sflow.DecodeError("truncated sample")
+            source_ids.add(_U32.unpack_from(data, start + 4)[0])
+            if records:
+                for rec_fmt, _, _ in sflow.iter_record_bounds(data, fmt, start, end):
+                    record_formats.add(rec_fmt)
+    except sflow.DecodeError:
+        return None
+    return DatagramSummary(
+        dgram.agent_address,
+        frozenset(source_ids),
+        frozenset(sample_formats),
+        frozenset(record_formats),
+    )
+
+
+@dataclass
+class TargetFilter:
+    """Forward a datagram only if it matches every non-empty criterion.
+
+    A datagram matches `source_ids`, `sample_formats` or `record_formats`
+    when any one of its samples, or any flow/counter record of them, does.
+    Sample and record formats are separate number spaces (a counters
+    sample is 2, so is an ethernet counter record). Datagrams that do not
+    parse never match.
+    """
+
+    agents: FrozenSet[bytes] = frozenset()
+    source_ids: FrozenSet[int] = frozenset()
+    sample_formats: FrozenSet[int] = frozenset()
+    record_formats: FrozenSet[int] = frozenset()
+
+    @classmethod
+    def create(
+        cls,
+        agents: Iterable[str] = (),
+        source_ids: Iterable[int] = (),
+        sample_formats: Iterable[int] = (),
+        record_formats: Iterable[int] = (),
+    ) -> "TargetFilter":
+        return cls(
+            frozenset(ipaddress.ip_address(a).packed for a in agents),
+            frozenset(source_ids),
+            frozenset(sample_formats),
+            frozenset(record_formats),
+        )
+
+    def matches(self, summary: Optional[DatagramSummary]) -> bool:
+        if summary is None:
+            return False
+        if self.agents and summary.agent_address not in self.agents:
+            return False
+        if self.source_ids and self.source_ids.isdisjoint(summary.source_ids):
+            return False
+        if self.sample_formats and self.sample_formats.isdisjoint(
+            summary.sample_formats
+        ):
+            return False
+        if self.record_formats and self.record_formats.isdisjoint(
+            summary.record_formats
+        ):
+            return False
+        return True
+
+
+@dataclass
+class TargetStats:
+    forwarded: int = 0
+    forwarded_bytes: int = 0
+    filtered: int = 0
+    dropped: int = 0
+    send_errors: int = 0
+    batches: int = 0
+
+    def snapshot(self) -> Dict[str, int]:
+        return {f.name: getattr(self, f.name) for f in fields(self)}
+
+
+@dataclass
+class ReplicationTarget:
+    address: Tuple[str, int]
+    filter: Optional[TargetFilter] = None
+    name: str = ""
+    stats: TargetStats = field(default_factory=TargetStats)
+    sock: Optional[socket.socket] = None
+
+    def __post_init__(self) -> None:
+        if not self.name:
+            self.name = f"{self.address[0]}:{self.address[1]}"
+
+    def open(self, sndbuf: int = 4 << 20) -> None:
+        family = socket.AF_INET6 if ":" in self.address[0] else socket.AF_INET
+        sock = socket.socket(family, socket.SOCK_DGRAM)
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_SNDBUF, sndbuf)
+        sock.setblocking(False)
+        # connected, so sendmmsg needs no per-message address
+        sock.connect(self.address)
+        self.sock = sock
+
+    def close(self) -> None:
+        if self.sock is not None:
+            self.sock.close()
+            self.sock = None
+
+
+_FILTER_KEYS = {
+    "agent": "agents",
+    "source_id": "source_ids",
+    "sample_format": "sample_formats",
+    "record_format": "record_formats",
+}
+
+
+def parse_target(spec: str) -> ReplicationTarget:
+    """Parse "host:port[,key=value...]" into a target.
+
+    Keys are agent, source_id, sample_format and record_format; each may
+    repeat and a datagram must match one value of every key given, e.g.
+    "10.0.0.7:6343,agent=192.0.2.1,agent=192.0.2.2,sample_format=2".
+    """
+    address, *criteria = spec.split(",")
+    host, port = address.rsplit(":", 1)
+    values: Dict[str, list] = {}
+    for item in criteria:
+        key, sep, value = item.partition("=")
+        if not sep or key not in _FILTER_KEYS:
+            raise ValueError(
+                f"bad filter {item!r}, expected one of {list(_FILTER_KEYS)}"
+            )
+        values.setdefault(_FILTER_KEYS[key], []).append(
+            value if key == "agent" else int(value)
+        )
+    flt = TargetFilter.create(**values) if values else None
+    return ReplicationTarget((host.strip("[]"), int(port)), flt)
+
+
+class Replicator:
+    """Fans datagrams out to a fixed set of targets."""
+
+    def __init__(self, targets: Sequence[ReplicationTarget]) -> None:
+        self.targets = list(targets)
+        self.use_sendmmsg = _sendmmsg is not None
+        # only filters on record formats need the records walked
+        self._records = any(t.filter and t.filter.record_formats for t in self.targets)
+        # several receive threads may forward through the shared vectors
+        self._lock = threading.Lock()
+        self._vec = (_MMsgHdr * MAX_BATCH)()
+        self._iov = (_IoVec * MAX_BATCH)()
+        for i in range(MAX_BATCH):
+            self._vec[i].msg_hdr.msg_iov = ctypes.pointer(self._iov[i])
+            self._vec[i].msg_hdr.msg_iovlen = 1
+
+    def open(self) -> None:
+        for target in self.targets:
+            target.open()
+
+    def close(self) -> None:
+        for target in self.targets:
+            target.close()
+
+    def stats(self) -> Dict[str, Dict[str, int]]:
+        return {t.name: t.stats.snapshot() for t in self.targets}
+
+    def forward(
+        self, batch: Sequence[Tuple[bytes, tuple]]
+    ) -> Optional[List[Optional[Parsed]]]:
+        """Forward a batch of (raw datagram, peer) as received.
+
+        Datagrams that do not parse go only to unfiltered targets. When a
+        filter needed them, returns parse_bounds() of every datagram so
+        the caller can decode on from there; otherwise None.
+        """
+        datagrams = [data for data, _ in batch]
+        parsed = summaries = None
+        with self._lock:
+            for target in self.targets:
+                flt = target.filter
+                if flt is None:
+                    out = datagrams
+                else:
+                    if summaries is None:
+                        parsed = [parse_bounds(d) for d in datagrams]
+                        summaries = [
+                            None if p is None else summarize(d, self._records, p)
+                            for d, p in zip(datagrams, parsed)
+                        ]
+                    out = [d for d, s in zip(datagrams, summaries) if flt.matches(s)]
+                    target.stats.filtered += len(batch) - len(out)
+                if out:
+                    self._send(target, out)
+        return parsed
+
+    def _send(self, target: ReplicationTarget, out: List[bytes]) -> None:
+        stats = target.stats
+        stats.batches += 1
+        for start in range(0, len(out), MAX_BATCH):
+            chunk = out[start : start + MAX_BATCH]
+            if self.use_sendmmsg:
+                sent, sent_bytes = self._sendmmsg(target, chunk)
+            else:
+                sent, sent_bytes = self._send_each(target, chunk)
+            stats.forwarded += sent
+            stats.forwarded_bytes += sent_bytes
+            # whatever the socket did not take is lost for this target only
+            stats.dropped += len(chunk) - sent
+
+    def _sendmmsg(
+        self, target: ReplicationTarget, chunk: List[bytes]
+    ) -> Tuple[int, int]:
+        iov = self._iov
+        for i, data in enumerate(chunk):
+            # points at the bytes object's own buffer, no copy
+            iov[i].iov_base = ctypes.cast(ctypes.c_char_p(data), ctypes.c_void_p)
+            iov[i].iov_len = len(data)
+        fd = target.sock.fileno()
+        pos = sent = sent_bytes = 0
+        while pos < len(chunk):
+            n = _sendmmsg(
+                fd,
+                ctypes.addressof(self._vec) + pos * ctypes.sizeof(_MMsgHdr),
+                len(chunk) - pos,
+                socket.MSG_DONTWAIT,
+            )
+            if n > 0:
+                sent += n
+                sent_bytes += sum(len(d) for d in chunk[pos : pos + n])
+                pos += n
+                continue
+            if n == 0:
+                break
+            err = ctypes.get_errno()
+            if err == errno.EINTR:
+                continue
+            if err in (errno.EAGAIN, errno.EWOULDBLOCK):
+                break
+            # e.g. ECONNREFUSED from an earlier ICMP error: skip this one
+            target.stats.send_errors += 1
+            pos += 1
+        return sent, sent_bytes
+
+    def _send_each(
+        self, target: ReplicationTarget, chunk: List[bytes]
+    ) -> Tuple[int, int]:
+        sent = sent_bytes = 0
+        for data in chunk:
+            try:
+                target.sock.send(data)
+            except BlockingIOError:
+                break
+            except OSError:
+                target.stats.send_errors += 1
+                continue
+            sent += 1
+            sent_bytes += len(data)
+        return sent, sent_bytes
@@ -0,0 +1,596 @@
+"""sFlow v5 datagram decoder.
+
+Decodes the structures described in sflow_format.h. Every opaque<> is
+walked using its own length so unknown or enterprise specific records are
+kept as raw bytes instead of aborting the whole datagram.
+"""
+import struct
+from collections import namedtuple
+from dataclasses import dataclass, field
+from typing import Dict, List, Tuple, Union
+
+SFLOW_VERSION_5 = 5
+
+ADDRESS_UNKNOWN = 0
+ADDRESS_IP_V4 = 1
+ADDRESS_IP_V6 = 2
+
+# sample_data formats (enterprise 0)
+SAMPLE_FLOW = 1
+SAMPLE_COUNTERS = 2
+
+# flow_data formats (enterprise 0)
+FLOW_SAMPLED_HEADER = 1
+FLOW_SAMPLED_ETHERNET = 2
+FLOW_SAMPLED_IPV4 = 3
+FLOW_SAMPLED_IPV6 = 4
+FLOW_EXT_SWITCH = 1001
+FLOW_EXT_ROUTER = 1002
+FLOW_EXT_GATEWAY = 1003
+FLOW_EXT_USER = 1004
+FLOW_EXT_URL = 1005
+FLOW_EXT_MPLS = 1006
+FLOW_EXT_NAT = 1007
+FLOW_EXT_MPLS_TUNNEL = 1008
+FLOW_EXT_MPLS_VC = 1009
+FLOW_EXT_MPLS_FTN = 1010
+FLOW_EXT_MPLS_LDP_FEC = 1011
+FLOW_EXT_VLAN_TUNNEL = 1012
+
+# counter_data formats (enterprise 0)
+COUNTERS_IF = 1
+COUNTERS_ETHERNET = 2
+COUNTERS_TOKENRING = 3
+COUNTERS_VG = 4
+COUNTERS_VLAN = 5
+COUNTERS_PROCESSOR = 1001
+
+# header_protocol
+HDR_PROTO_ETHERNET = 1
+HDR_PROTO_IPV4 = 11
+HDR_PROTO_IPV6 = 12
+
+_U32 = struct.Struct("!I")
+_U32X2 = struct.Struct("!II")
+_U32X3 = struct.Struct("!III")
+_U32X4 = struct.Struct("!IIII")
+_FLOW_SAMPLE = struct.Struct("!IIIIIIII")
+
+
+class DecodeError(ValueError):
+    pass
+
+
+# fixed layout flow records
+SampledEthernet = namedtuple("SampledEthernet", "length src_mac dst_mac type")
+SampledIPv4 = namedtuple(
+    "SampledIPv4", "length protocol src_ip dst_ip src_port dst_port tcp_flags tos"
+)
+SampledIPv6 = namedtuple(
+    "SampledIPv6",
+    "length protocol src_ip dst_ip src_port dst_port tcp_flags priority",
+)
+ExtendedSwitch = namedtuple(
+    "ExtendedSwitch", "src_vlan src_priority dst_vlan dst_priority"
+)
+ExtendedMplsLdpFec = namedtuple("ExtendedMplsLdpFec", "prefix_length")
+
+# variable layout flow records
+SampledHeader = namedtuple("SampledHeader", "protocol frame_length stripped header")
+ExtendedRouter = namedtuple("ExtendedRouter", "nexthop src_mask_len dst_mask_len")
+ExtendedGateway = namedtuple(
+    "ExtendedGateway",
+    "nexthop as_number src_as src_peer_as dst_as_path communities localpref",
+)
+ExtendedUser = namedtuple("ExtendedUser", "src_charset src_user dst_charset dst_user")
+ExtendedUrl = namedtuple("ExtendedUrl", "direction url host")
+ExtendedMpls = namedtuple("ExtendedMpls", "nexthop in_stack out_stack")
+ExtendedNat = namedtuple("ExtendedNat", "src_address dst_address")
+ExtendedMplsTunnel = namedtuple("ExtendedMplsTunnel", "name tunnel_id tunnel_cos")
+ExtendedMplsVc = namedtuple("ExtendedMplsVc", "name vc_id vc_label_cos")
+ExtendedMplsFtn = namedtuple("ExtendedMplsFtn", "descr mask")
+ExtendedVlanTunnel = namedtuple("ExtendedVlanTunnel", "stack")
+
+# counter records, all fixed layout
+IfCounters = namedtuple(
+    "IfCounters",
+    "if_index if_type if_speed if_direction if_status "
+    "in_octets in_ucast_pkts in_multicast_pkts in_broadcast_pkts "
+    "in_discards in_errors in_unknown_protos "
+    "out_octets out_ucast_pkts out_multicast_pkts out_broadcast_pkts "
+    "out_discards out_errors promiscuous_mode",
+)
+EthernetCounters = namedtuple(
+    "EthernetCounters",
+    "alignment_errors fcs_errors single_collision_frames "
+    "multiple_collision_frames sqe_test_errors deferred_transmissions "
+    "late_collisions excessive_collisions internal_mac_transmit_errors "
+    "carrier_sense_errors frame_too_longs internal_mac_receive_errors "
+    "symbol_errors",
+)
+TokenringCounters = namedtuple(
+    "TokenringCounters",
+    "line_errors burst_errors ac_errors abort_trans_errors internal_errors "
+    "lost_frame_errors receive_congestions frame_copied_errors token_errors "
+    "soft_errors hard_errors signal_loss transmit_beacons recoverys "
+    "lobe_wires removes singles freq_errors",
+)
+VgCounters = namedtuple(
+    "VgCounters",
+    "in_high_priority_frames in_high_priority_octets "
+    "in_norm_priority_frames in_norm_priority_octets "
+    "in_ipm_errors in_oversize_frame_errors in_data_errors "
+    "in_null_addressed_frames out_high_priority_frames "
+    "out_high_priority_octets transition_into_trainings "
+    "hc_in_high_priority_octets hc_in_norm_priority_octets "
+    "hc_out_high_priority_octets",
+)
+VlanCounters = namedtuple(
+    "VlanCounters",
+    "vlan_id octets ucast_pkts multicast_pkts broadcast_pkts discards",
+)
+ProcessorCounters = namedtuple(
+    "ProcessorCounters", "cpu_5s cpu_1m cpu_5m total_memory free_memory"
+)
+
+# XDR pads fixed opaque<6> MAC addresses to 8 bytes
+FIXED_FLOW_FORMATS: Dict[int, Tuple[struct.Struct, type]] = {
+    FLOW_SAMPLED_ETHERNET: (struct.Struct("!I6s2x6s2xI"), SampledEthernet),
+    FLOW_SAMPLED_IPV4: (struct.Struct("!II4s4sIIII"), SampledIPv4),
+    FLOW_SAMPLED_IPV6: (struct.Struct("!II16s16sIIII"), SampledIPv6),
+    FLOW_EXT_SWITCH: (struct.Struct("!IIII"), ExtendedSwitch),
+    FLOW_EXT_MPLS_LDP_FEC: (struct.Struct("!I"), ExtendedMplsLdpFec),
+}
+
+COUNTER_FORMATS: Dict[int, Tuple[struct.Struct, type]] = {
+    COUNTERS_IF: (struct.Struct("!IIQIIQIIIIIIQIIIIII"), IfCounters),
+    COUNTERS_ETHERNET: (struct.Struct("!13I"), EthernetCounters),
+    COUNTERS_TOKENRING: (struct.Struct("!18I"), TokenringCounters),
+    COUNTERS_VG: (struct.Struct("!IQIQIIIIIQIQQQ"), VgCounters),
+    COUNTERS_VLAN: (struct.Struct("!IQIIII"), VlanCounters),
+    COUNTERS_PROCESSOR: (struct.Struct("!iiiQQ"), ProcessorCounters),
+}
+
+
+def struct_codes(st: struct.Struct) -> str:
+    """Expand a struct format such as "!13I" into one code per field."""
+    codes = []
+    count = ""
+    for ch in st.format.lstrip("!"):
+        if ch.isdigit():
+            count += ch
+        else:
+            codes.append(ch * int(count or 1))
+            count = ""
+    return "".join(codes)
+
+
+@dataclass
+class Record:
+    """A flow_record or counter_record. `data` holds the decoded namedtuple,
+    or the raw opaque bytes when the format is not understood."""
+
+    data_format: int
+    data: object
+
+    @property
+    def enterprise(self) -> int:
+        return self.data_format >> 12
+
+    @property
+    def format(self) -> int:
+        return self.data_format & 0xFFF
+
+
+@dataclass
+class FlowSample:
+    sequence_number: int
+    source_id: int
+    sampling_rate: int
+    sample_pool: int
+    drops: int
+    input: int
+    output: int
+    records: List[Record] = field(default_factory=list)
+    data_format: int = SAMPLE_FLOW
+
+    def record(self, fmt: int):
+        for rec in self.records:
+            if rec.data_format == fmt:
+                return rec.data
+        return None
+
+
+@dataclass
+class CountersSample:
+    sequence_number: int
+    source_id: int
+    records: List[Record] = field(default_factory=list)
+    data_format: int = SAMPLE_COUNTERS
+
+    def record(self, fmt: int):
+        for rec in self.records:
+            if rec.data_format == fmt:
+                return rec.data
+        return None
+
+
+@dataclass
+class RawSample:
+    """A sample_record whose sample_type is not decoded."""
+
+    data_format: int
+    data: bytes
+
+
+Sample = Union[FlowSample, CountersSample, RawSample]
+
+
+@dataclass
+class Datagram:
+    version: int
+    agent_address: bytes  # 4 or 16 bytes, empty when the type is UNKNOWN
+    sub_agent_id: int
+    sequence_number: int
+    uptime: int
+    sample_count: int
+    samples: List[Sample] = field(default_factory=list)
+    # byte offset of the first sample_record, filled by decode_header()
+    samples_offset: int = 0
+
+
+class _Reader:
+    __slots__ = ("buf", "off", "end")
+
+    def __init__(self, buf, off: int = 0, end: int = -1) -> None:
+        self.buf = buf
+        self.off = off
+        self.end = len(buf) if end < 0 else end
+
+    def need(self, n: int) -> None:
+        if self.off + n > self.end:
+            have = self.end - self.off
+            raise DecodeError(f"truncated: need {n} bytes at {self.off}, have {have}")
+
+    def u32(self) -> int:
+        self.need(4)
+        val = _U32.unpack_from(self.buf, self.off)[0]
+        self.off += 4
+        return val
+
+    def fixed(self, st: struct.Struct) -> tuple:
+        self.need(st.size)
+        vals = st.unpack_from(self.buf, self.off)
+        self.off += st.size
+        return vals
+
+    def opaque(self) -> bytes:
+        n = self.u32()
+        padded = (n + 3) & ~3
+        self.need(padded)
+        val = bytes(self.buf[self.off : self.off + n])
+        self.off += padded
+        return val
+
+    def opaque_bounds(self) -> Tuple[int, int]:
+        """Skip an opaque<> and return its (start, end) within buf."""
+        n = self.u32()
+        padded = (n + 3) & ~3
+        self.need(padded)
+        start = self.off
+        self.off += padded
+        return start, start + n
+
+    def u32_array(self) -> Tuple[int, ...]:
+        n = self.u32()
+        self.need(4 * n)
+        vals = struct.unpack_from(f"!{n}I", self.buf, self.off)
+        self.off += 4 * n
+        return vals
+
+    def i32_array(self) -> Tuple[int, ...]:
+        n = self.u32()
+        self.need(4 * n)
+        vals = struct.unpack_from(f"!{n}i", self.buf, self.off)
+        self.off += 4 * n
+        return vals
+
+    def address(self) -> bytes:
+        addr_type = self.u32()
+        if addr_type == ADDRESS_IP_V4:
+            size = 4
+        elif addr_type == ADDRESS_IP_V6:
+            size = 16
+        elif addr_type == ADDRESS_UNKNOWN:
+            return b""
+        else:
+            raise DecodeError(f"unknown address type: {addr_type}")
+        self.need(size)
+        val = bytes(self.buf[self.off : self.off + size])
+        self.off += size
+        return val
+
+
+def _decode_gateway(r: _Reader) -> ExtendedGateway:
+    nexthop = r.address()
+    as_number, src_as, src_peer_as = r.fixed(_U32X3)
+    segments = []
+    for _ in range(r.u32()):
+        seg_type = r.u32()
+        segments.append((seg_type, r.u32_array()))
+    communities = r.u32_array()
+    localpref = r.u32()
+    return ExtendedGateway(
+        nexthop, as_number, src_as, src_peer_as, segments, communities, localpref
+    )
+
+
+def _decode_variable_flow(fmt: int, r: _Reader):
+    if fmt == FLOW_SAMPLED_HEADER:
+        protocol, frame_length, stripped = r.fixed(_U32X3)
+        return SampledHeader(protocol, frame_length, stripped, r.opaque())
+    if fmt == FLOW_EXT_ROUTER:
+        nexthop = r.address()
+        return ExtendedRouter(nexthop, *r.fixed(_U32X2))
+    if fmt == FLOW_EXT_GATEWAY:
+        return _decode_gateway(r)
+    if fmt == FLOW_EXT_USER:
+        src_charset = r.u32()
+        src_user = r.opaque()
+        dst_charset = r.u32()
+        return ExtendedUser(src_charset, src_user, dst_charset, r.opaque())
+    if fmt == FLOW_EXT_URL:
+        direction = r.u32()
+        url = r.opaque()
+        return ExtendedUrl(direction, url, r.opaque())
+    if fmt == FLOW_EXT_MPLS:
+        nexthop = r.address()
+        in_stack = r.i32_array()
+        return ExtendedMpls(nexthop, in_stack, r.i32_array())
+    if fmt == FLOW_EXT_NAT:
+        src = r.address()
+        return ExtendedNat(src, r.address())
+    if fmt == FLOW_EXT_MPLS_TUNNEL:
+        name = r.opaque()
+        return ExtendedMplsTunnel(name, *r.fixed(_U32X2))
+    if fmt == FLOW_EXT_MPLS_VC:
+        name = r.opaque()
+        return ExtendedMplsVc(name, *r.fixed(_U32X2))
+    if fmt == FLOW_EXT_MPLS_FTN:
+        descr = r.opaque()
+        return ExtendedMplsFtn(descr, r.u32())
+    if fmt == FLOW_EXT_VLAN_TUNNEL:
+        return ExtendedVlanTunnel(r.u32_array())
+    return None
+
+
+def decode_flow_record(data_format: int, buf, start: int, end: int):
+    """Decode one flow_data opaque occupying buf[start:end]."""
+    if data_format >> 12 == 0:
+        fixed = FIXED_FLOW_FORMATS.get(data_format)
+        if fixed is not None:
+            st, cls = fixed
+            if end - start < st.size:
+                raise DecodeError(f"flow record {data_format} too short")
+            return cls._make(st.unpack_from(buf, start))
+        val = _decode_variable_flow(data_format, _Reader(buf, start, end))
+        if val is not None:
+            return val
+    return bytes(buf[start:end])
+
+
+def decode_counter_record(data_format: int, buf, start: int, end: int):
+    """Decode one counter_data opaque occupying buf[start:end]."""
+    if data_format >> 12 == 0:
+        fixed = COUNTER_FORMATS.get(data_format)
+        if fixed is not None:
+            st, cls = fixed
+            if end - start < st.size:
+                raise DecodeError(f"counter record {data_format} too short")
+            return cls._make(st.unpack_from(buf, start))
+    return bytes(buf[start:end])
+
+
+def _decode_records(r: _Reader, decode) -> List[Record]:
+    records = []
+    for _ in range(r.u32()):
+        data_format = r.u32()
+        start, end = r.opaque_bounds()
+        records.append(Record(data_format, decode(data_format, r.buf, start, end)))
+    return records
+
+
+def decode_sample(data_format: int, buf, start: int, end: int) -> Sample:
+    """Decode one sample_data opaque occupying buf[start:end]."""
+    r = _Reader(buf, start, end)
+    if data_format == SAMPLE_FLOW:
+        sample = FlowSample(*r.fixed(_FLOW_SAMPLE)[:7])
+        # the record count is the last word of the fixed part
+        r.off -= 4
+        sample.records = _decode_records(r, decode_flow_record)
+        return sample
+    if data_format == SAMPLE_COUNTERS:
+        seq, source_id = r.fixed(_U32X2)
+        sample = CountersSample(seq, source_id)
+        sample.records = _decode_records(r, decode_counter_record)
+        return sample
+    return RawSample(data_format, bytes(buf[start:end]))
+
+
+def decode_header(buf) -> Datagram:
+    """Decode only the datagram header, leaving `samples` empty.
+
+    `samples_offset` points at the first sample_record so the caller can
+    continue with decode_samples() without re-reading the header.
+    """
+    r = _Reader(buf)
+    version = r.u32()
+    if version != SFLOW_VERSION_5:
+        raise DecodeError(f"unsupported sFlow version: {version}")
+    agent_address = r.address()
+    sub_agent_id, seq_num, uptime, sample_count = r.fixed(_U32X4)
+    return Datagram(
+        version,
+        agent_address,
+        sub_agent_id,
+        seq_num,
+        uptime,
+        sample_count,
+        samples_offset=r.off,
+    )
+
+
+def iter_sample_bounds(buf, dgram: Datagram):
+    """Yield (data_format, start, end) for each sample_record of dgram."""
+    r = _Reader(buf, dgram.samples_offset)
+    for _ in range(dgram.sample_count):
+        data_format = r.u32()
+        start, end = r.opaque_bounds()
+        yield data_format, start, end
+
+
+def iter_record_bounds(buf, data_format: int, start: int, end: int):
+    """Yield (record_format, start, end) for each flow_record or
+    counter_record of the sample occupying buf[start:end]."""
+    r = _Reader(buf, start, end)
+    if data_format == SAMPLE_FLOW:
+        r.off += _FLOW_SAMPLE.size - 4
+    elif data_format == SAMPLE_COUNTERS:
+        r.off += 8
+    else:
+        return
+    for _ in range(r.u32()):
+        record_format = r.u32()
+        rstart, rend = r.opaque_bounds()
+        yield record_format, rstart, rend
+
+
+def decode_samples(buf, dgram: Datagram) -> Datagram:
+    dgram.samples = [
+        decode_sample(fmt, buf, start, end)
+        for fmt, start, end in iter_sample_bounds(buf, dgram)
+    ]
+    return dgram
+
+
+def decode_datagram(buf) -> Datagram:
+    return decode_samples(buf, decode_header(buf))
+
+
+# -- encoding ----------------------------------------------------------------
+#
+# The inverse of the decoders above, used by the synthetic corpus generator
+# and by tests. Records are the same namedtuples the decoder returns.
+
+
+def encode_opaque(data: bytes) -> bytes:
+    return _U32.pack(len(data)) + data + b"\0" * (-len(data) % 4)
+
+
+def encode_address(addr: bytes) -> bytes:
+    if len(addr) == 4:
+        return _U32.pack(ADDRESS_IP_V4) + addr
+    if len(addr) == 16:
+        return _U32.pack(ADDRESS_IP_V6) + addr
+    if not addr:
+        return _U32.pack(ADDRESS_UNKNOWN)
+    raise ValueError(f"bad address length: {len(addr)}")
+
+
+def _encode_u32_array(vals, fmt: str = "I") -> bytes:
+    return _U32.pack(len(vals)) + struct.pack(f"!{len(vals)}{fmt}", *vals)
+
+
+def _encode_variable_flow(fmt: int, rec) -> bytes:
+    if fmt == FLOW_SAMPLED_HEADER:
+        return _U32X3.pack(*rec[:3]) + encode_opaque(rec.header)
+    if fmt == FLOW_EXT_ROUTER:
+        return encode_address(rec.nexthop) + _U32X2.pack(*rec[1:])
+    if fmt == FLOW_EXT_GATEWAY:
+        out = [encode_address(rec.nexthop), _U32X3.pack(*rec[1:4])]
+        out.append(_U32.pack(len(rec.dst_as_path)))
+        for seg_type, path in rec.dst_as_path:
+            out.append(_U32.pack(seg_type) + _encode_u32_array(path))
+        out.append(_encode_u32_array(rec.communities))
+        out.append(_U32.pack(rec.localpref))
+        return b"".join(out)
+    if fmt == FLOW_EXT_USER:
+        return (
+            _U32.pack(rec.src_charset)
+            + encode_opaque(rec.src_user)
+            + _U32.pack(rec.dst_charset)
+            + encode_opaque(rec.dst_user)
+        )
+    if fmt == FLOW_EXT_URL:
+        url = encode_opaque(rec.url)
+        return _U32.pack(rec.direction) + url + encode_opaque(rec.host)
+    if fmt == FLOW_EXT_MPLS:
+        return (
+            encode_address(rec.nexthop)
+            + _encode_u32_array(rec.in_stack, "i")
+            + _encode_u32_array(rec.out_stack, "i")
+        )
+    if fmt == FLOW_EXT_NAT:
+        return encode_address(rec.src_address) + encode_address(rec.dst_address)
+    if fmt in (FLOW_EXT_MPLS_TUNNEL, FLOW_EXT_MPLS_VC):
+        return encode_opaque(rec[0]) + _U32X2.pack(*rec[1:])
+    if fmt == FLOW_EXT_MPLS_FTN:
+        return encode_opaque(rec.descr) + _U32.pack(rec.mask)
+    if fmt == FLOW_EXT_VLAN_TUNNEL:
+        return _encode_u32_array(rec.stack)
+    raise ValueError(f"cannot encode flow record format {fmt}")
+
+
+def encode_flow_record(data_format: int, rec) -> bytes:
+    """Encode a flow_record; bytes are emitted as an opaque payload."""
+    if isinstance(rec, (bytes, bytearray)):
+        body = bytes(rec)
+    elif data_format in FIXED_FLOW_FORMATS:
+        body = FIXED_FLOW_FORMATS[data_format][0].pack(*rec)
+    else:
+        body = _encode_variable_flow(data_format, rec)
+    return _U32.pack(data_format) + encode_opaque(body)
+
+
+def encode_counter_record(data_format: int, rec) -> bytes:
+    if isinstance(rec, (bytes, bytearray)):
+        body = bytes(rec)
+    else:
+        body = COUNTER_FORMATS[data_format][0].pack(*rec)
+    return _U32.pack(data_format) + encode_opaque(body)
+
+
+def encode_sample(sample: Sample) -> bytes:
+    if isinstance(sample, FlowSample):
+        body = [
+            _FLOW_SAMPLE.pack(
+                sample.sequence_number,
+                sample.source_id,
+                sample.sampling_rate,
+                sample.sample_pool,
+                sample.drops,
+                sample.input,
+                sample.output,
+                len(sample.records),
+            )
+        ]
+        body += [encode_flow_record(r.data_format, r.data) for r in sample.records]
+    elif isinstance(sample, CountersSample):
+        body = [
+            _U32X3.pack(sample.sequence_number, sample.source_id, len(sample.records))
+        ]
+        body += [encode_counter_record(r.data_format, r.data) for r in sample.records]
+    else:
+        body = [sample.data]
+    return _U32.pack(sample.data_format) + encode_opaque(b"".join(body))
+
+
+def encode_datagram(dgram: Datagram) -> bytes:
+    out = [_U32.pack(dgram.version), encode_address(dgram.agent_address)]
+    out.append(
+        _U32X4.pack(
+            dgram.sub_agent_id, dgram.sequence_number, dgram.uptime, len(dgram.samples)
+        )
+    )
+    out += [encode_sample(s) for s in dgram.samples]
+    return b"".join(out)
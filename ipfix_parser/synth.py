@@ -0,0 +1,662 @@
+"""Deterministic synthetic sFlow v5 and IPFIX traffic.
+
+Both generators are driven by a seeded random.Random, so the same mix and
+seed always yield byte-identical datagrams. They are used by the benchmark
+suite and by tests.
+"""
+
+import random
+import struct
+from dataclasses import dataclass, field
+from typing import Dict, Iterator, List, Optional, Sequence, Tuple
+
+from ipfix_parser import ipfix, sflow
+from ipfix_parser.ipfix import FieldSpec, Template
+
+SFLOW_ALL_FLOW_FORMATS = (
+    sflow.FLOW_SAMPLED_HEADER,
+    sflow.FLOW_SAMPLED_ETHERNET,
+    sflow.FLOW_SAMPLED_IPV4,
+    sflow.FLOW_SAMPLED_IPV6,
+    sflow.FLOW_EXT_SWITCH,
+    sflow.FLOW_EXT_ROUTER,
+    sflow.FLOW_EXT_GATEWAY,
+    sflow.FLOW_EXT_USER,
+    sflow.FLOW_EXT_URL,
+    sflow.FLOW_EXT_MPLS,
+    sflow.FLOW_EXT_NAT,
+    sflow.FLOW_EXT_MPLS_TUNNEL,
+    sflow.FLOW_EXT_MPLS_VC,
+    sflow.FLOW_EXT_MPLS_FTN,
+    sflow.FLOW_EXT_MPLS_LDP_FEC,
+    sflow.FLOW_EXT_VLAN_TUNNEL,
+)
+
+SFLOW_ALL_COUNTER_FORMATS = tuple(sflow.COUNTER_FORMATS)
+
+# enterprise number used for vendor specific records
+SYNTH_ENTERPRISE = 4300
+
+_PROTOCOLS = (6, 6, 6, 17, 17, 1)
+
+
+@dataclass
+class SflowMix:
+    """Shape of a synthetic sFlow stream.
+
+    `flow_records` and `counter_records` give the probability that each
+    record format appears in a flow or counters sample. With
+    `opaque_padding` every opaque<> and string<> gets a length that is not
+    a multiple of four, exercising XDR padding. `enterprise_records` is the
+    probability of appending a vendor record to a sample.
+    """
+
+    seed: int = 1
+    agents: int = 16
+    ipv6_agents: float = 0.0
+    interfaces_per_agent: int = 48
+    samples_per_datagram: int = 8
+    counters_ratio: float = 0.1
+    flow_records: Dict[int, float] = field(
+        default_factory=lambda: {
+            sflow.FLOW_SAMPLED_HEADER: 1.0,
+            sflow.FLOW_EXT_SWITCH: 1.0,
+            sflow.FLOW_EXT_ROUTER: 0.5,
+            sflow.FLOW_EXT_GATEWAY: 0.2,
+        }
+    )
+    counter_records: Dict[int, float] = field(
+        default_factory=lambda: {
+            sflow.COUNTERS_IF: 1.0,
+            sflow.COUNTERS_ETHERNET: 1.0,
+            sflow.COUNTERS_VLAN: 0.1,
+            sflow.COUNTERS_PROCESSOR: 0.1,
+        }
+    )
+    header_sizes: Sequence[int] = (64, 128)
+    opaque_padding: bool = False
+    enterprise_records: float = 0.0
+    sampling_rate: int = 1024
+
+    @classmethod
+    def everything(cls, **kwargs) -> "SflowMix":
+        """A mix that emits every structure in sflow_format.h."""
+        kwargs.setdefault("flow_records", dict.fromkeys(SFLOW_ALL_FLOW_FORMATS, 1.0))
+        kwargs.setdefault(
+            "counter_records", dict.fromkeys(SFLOW_ALL_COUNTER_FORMATS, 1.0)
+        )
+        kwargs.setdefault("counters_ratio", 0.5)
+        kwargs.setdefault("opaque_padding", True)
+        kwargs.setdefault("enterprise_records", 0.5)
+        kwargs.setdefault("header_sizes", (66, 127, 128))
+        return cls(**kwargs)
+
+
+@dataclass
+class _Agent:
+    address: bytes
+    sequence_number: int = 0
+    uptime: int = 0
+    flow_seq: Dict[int, int] = field(default_factory=dict)
+    counter_seq: Dict[int, int] = field(default_factory=dict)
+    # monotonically increasing if_counters per ifIndex
+    octets: Dict[int, Tuple[int, int]] = field(default_factory=dict)
+
+
+class SflowGenerator:
+    def __init__(self, mix: Optional[SflowMix] = None) -> None:
+        self.mix = mix or SflowMix()
+        self.rng = random.Random(self.mix.seed)
+        self.agents = [self._make_agent(i) for i in range(self.mix.agents)]
+        self.uptime_step = 20
+
+    def _make_agent(self, index: int) -> _Agent:
+        if self.rng.random() < self.mix.ipv6_agents:
+            addr = b"\x20\x01\x0d\xb8" + bytes(10) + struct.pack("!H", index + 1)
+        else:
+            addr = struct.pack("!BBH", 10, 255, index + 1)
+        return _Agent(addr)
+
+    # -- field helpers -------------------------------------------------------
+
+    def _bytes(self, n: int) -> bytes:
+        return self.rng.getrandbits(8 * n).to_bytes(n, "big") if n else b""
+
+    def _text(self, lo: int, hi: int) -> bytes:
+        n = self.rng.randint(lo, hi)
+        if self.mix.opaque_padding and n % 4 == 0:
+            n += 1
+        return bytes(self.rng.choice(b"abcdefghijklmnopqrstuvwxyz/.") for _ in range(n))
+
+    def _ipv4(self) -> bytes:
+        return struct.pack(
+            "!BBBB",
+            10,
+            self.rng.randrange(256),
+            self.rng.randrange(256),
+            self.rng.randrange(1, 255),
+        )
+
+    def _ipv6(self) -> bytes:
+        return b"\x20\x01\x0d\xb8" + self._bytes(12)
+
+    def _address(self) -> bytes:
+        return self._ipv4() if self.rng.random() < 0.8 else self._ipv6()
+
+    def _packet(self, size: int) -> bytes:
+        """An Ethernet frame carrying TCP/UDP/ICMP, cut or padded to size."""
+        rng = self.rng
+        proto = rng.choice(_PROTOCOLS)
+        v6 = rng.random() < 0.2
+        eth = self._bytes(12)
+        if rng.random() < 0.5:
+            eth += struct.pack("!HH", 0x8100, rng.randrange(1, 4095))
+        if v6:
+            eth += b"\x86\xdd"
+            ip = struct.pack("!IHBB", 0x60000000, 40, proto, 64)
+            ip += self._ipv6() + self._ipv6()
+        else:
+            eth += b"\x08\x00"
+            ip = struct.pack(
+                "!BBHHHBBH4s4s",
+                0x45,
+                0,
+                40,
+                0,
+                0,
+                64,
+                proto,
+                0,
+                self._ipv4(),
+                self._ipv4(),
+            )
+        l4 = struct.pack(
+            "!HH", rng.randrange(1024, 65536), rng.choice((53, 80, 443, 8080))
+        )
+        l4 += self._bytes(16)
+        pkt = eth + ip + l4
+        if len(pkt) < size:
+            pkt += bytes(size - len(pkt))
+        return pkt[:size]
+
+    # -- records ---------------------------------------------------------------
+
+    def flow_record(self, fmt: int, frame_length: int):
+        rng = self.rng
+        if fmt == sflow.FLOW_SAMPLED_HEADER:
+            size = min(rng.choice(self.mix.header_sizes), frame_length)
+            if self.mix.opaque_padding and size % 4 == 0:
+                size -= 1
+            return sflow.SampledHeader(
+                sflow.HDR_PROTO_ETHERNET, frame_length, 4, self._packet(size)
+            )
+        if fmt == sflow.FLOW_SAMPLED_ETHERNET:
+            return sflow.SampledEthernet(
+                frame_length, self._bytes(6), self._bytes(6), 0x0800
+            )
+        if fmt == sflow.FLOW_SAMPLED_IPV4:
+            return sflow.SampledIPv4(
+                frame_length - 18,
+                rng.choice(_PROTOCOLS),
+                self._ipv4(),
+                self._ipv4(),
+                rng.randrange(65536),
+                rng.randrange(65536),
+                rng.randrange(64),
+                rng.randrange(256),
+            )
+        if fmt == sflow.FLOW_SAMPLED_IPV6:
+            return sflow.SampledIPv6(
+                frame_length - 18,
+                rng.choice(_PROTOCOLS),
+                self._ipv6(),
+                self._ipv6(),
+                rng.randrange(65536),
+                rng.randrange(65536),
+                rng.randrange(64),
+                rng.randrange(8),
+            )
+        if fmt == sflow.FLOW_EXT_SWITCH:
+            return sflow.ExtendedSwitch(
+                rng.randrange(4096),
+                rng.randrange(8),
+                rng.randrange(4096),
+                rng.randrange(8),
+            )
+        if fmt == sflow.FLOW_EXT_ROUTER:
+            return sflow.ExtendedRouter(
+                self._address(), rng.randrange(8, 33), rng.randrange(8, 33)
+            )
+        if fmt == sflow.FLOW_EXT_GATEWAY:
+            path = [
+                (2, tuple(rng.randrange(1, 65536) for _ in range(rng.randint(1, 6))))
+            ]
+            communities = tuple(rng.getrandbits(32) for _ in range(rng.randint(0, 4)))
+            return sflow.ExtendedGateway(
+                self._address(),
+                rng.randrange(1, 65536),
+                rng.randrange(1, 65536),
+                rng.randrange(1, 65536),
+                path,
+                communities,
+                100,
+            )
+        if fmt == sflow.FLOW_EXT_USER:
+            return sflow.ExtendedUser(106, self._text(3, 16), 106, self._text(3, 16))
+        if fmt == sflow.FLOW_EXT_URL:
+            return sflow.ExtendedUrl(
+                rng.choice((1, 2)), b"GET /" + self._text(1, 40), self._text(8, 24)
+            )
+        if fmt == sflow.FLOW_EXT_MPLS:
+            labels = tuple(
+                rng.getrandbits(19) << 12 | 64 for _ in range(rng.randint(0, 3))
+            )
+            return sflow.ExtendedMpls(self._address(), labels, labels[:1])
+        if fmt == sflow.FLOW_EXT_NAT:
+            return sflow.ExtendedNat(self._address(), self._address())
+        if fmt == sflow.FLOW_EXT_MPLS_TUNNEL:
+            return sflow.ExtendedMplsTunnel(
+                self._text(4, 20), rng.getrandbits(32), rng.randrange(8)
+            )
+        if fmt == sflow.FLOW_EXT_MPLS_VC:
+            return sflow.ExtendedMplsVc(
+                self._text(4, 20), rng.getrandbits(32), rng.randrange(8)
+            )
+        if fmt == sflow.FLOW_EXT_MPLS_FTN:
+            return sflow.ExtendedMplsFtn(self._text(4, 32), rng.getrandbits(32))
+        if fmt == sflow.FLOW_EXT_MPLS_LDP_FEC:
+            return sflow.ExtendedMplsLdpFec(rng.randrange(33))
+        if fmt == sflow.FLOW_EXT_VLAN_TUNNEL:
+            return sflow.ExtendedVlanTunnel(
+                tuple(
+                    0x81000000 | rng.randrange(4096) for _ in range(rng.randint(1, 3))
+                )
+            )
+        raise ValueError(f"no generator for flow record format {fmt}")
+
+    def counter_record(self, fmt: int, agent: _Agent, if_index: int):
+        rng = self.rng
+        if fmt == sflow.COUNTERS_IF:
+            in_octets, out_octets = agent.octets.get(if_index, (0, 0))
+            in_octets += rng.randrange(1 << 24)
+            out_octets += rng.randrange(1 << 24)
+            agent.octets[if_index] = (in_octets, out_octets)
+            in_pkts = (in_octets // 700) & 0xFFFFFFFF
+            out_pkts = (out_octets // 700) & 0xFFFFFFFF
+            return sflow.IfCounters(
+                if_index,
+                6,
+                10_000_000_000,
+                1,
+                3,
+                in_octets,
+                in_pkts,
+                in_pkts >> 6,
+                in_pkts >> 8,
+                0,
+                0,
+                0,
+                out_octets,
+                out_pkts,
+                out_pkts >> 6,
+                out_pkts >> 8,
+                0,
+                0,
+                0,
+            )
+        if fmt == sflow.COUNTERS_PROCESSOR:
+            total = 1 << 34
+            return sflow.ProcessorCounters(
+                rng.randrange(10000),
+                rng.randrange(10000),
+                rng.randrange(10000),
+                total,
+                rng.randrange(total),
+            )
+        st, cls = sflow.COUNTER_FORMATS[fmt]
+        # the remaining counter blocks are plain u32/u64 counters
+        return cls._make(
+            self.rng.getrandbits(40 if code == "Q" else 16)
+            for code in sflow.struct_codes(st)
+        )
+
+    def _vendor_record(self) -> sflow.Record:
+        fmt = (SYNTH_ENTERPRISE << 12) | self.rng.randrange(1, 16)
+        n = self.rng.randint(1, 24)
+        if self.mix.opaque_padding and n % 4 == 0:
+            n += 1
+        return sflow.Record(fmt, self._bytes(n))
+
+    def _pick(self, probs: Dict[int, float]) -> List[int]:
+        return [fmt for fmt, p in probs.items() if self.rng.random() < p]
+
+    # -- samples and datagrams ---------------------------------------------------
+
+    def flow_sample(self, agent: _Agent) -> sflow.FlowSample:
+        rng = self.rng
+        if_index = rng.randrange(1, self.mix.interfaces_per_agent + 1)
+        seq = agent.flow_seq.get(if_index, 0) + 1
+        agent.flow_seq[if_index] = seq
+        rate = self.mix.sampling_rate
+        frame_length = rng.randint(64, 1518)
+        sample = sflow.FlowSample(
+            seq,
+            if_index,
+            rate,
+            seq * rate,
+            0,
+            if_index,
+            rng.randrange(1, self.mix.interfaces_per_agent + 1),
+        )
+        for fmt in self._pick(self.mix.flow_records):
+            sample.records.append(
+                sflow.Record(fmt, self.flow_record(fmt, frame_length))
+            )
+        if rng.random() < self.mix.enterprise_records:
+            sample.records.append(self._vendor_record())
+        return sample
+
+    def counters_sample(self, agent: _Agent) -> sflow.CountersSample:
+        if_index = self.rng.randrange(1, self.mix.interfaces_per_agent + 1)
+        seq = agent.counter_seq.get(if_index, 0) + 1
+        agent.counter_seq[if_index] = seq
+        sample = sflow.CountersSample(seq, if_index)
+        for fmt in self._pick(self.mix.counter_records):
+            sample.records.append(
+                sflow.Record(fmt, self.counter_record(fmt, agent, if_index))
+            )
+        if self.rng.random() < self.mix.enterprise_records:
+            sample.records.append(self._vendor_record())
+        return sample
+
+    def datagram(self, agent_index: Optional[int] = None) -> sflow.Datagram:
+        if agent_index is None:
+            agent_index = self.rng.randrange(len(self.agents))
+        agent = self.agents[agent_index]
+        agent.sequence_number += 1
+        agent.uptime += self.uptime_step
+        dgram = sflow.Datagram(
+            sflow.SFLOW_VERSION_5,
+            agent.address,
+            0,
+            agent.sequence_number,
+            agent.uptime,
+            self.mix.samples_per_datagram,
+        )
+        for _ in range(self.mix.samples_per_datagram):
+            if self.rng.random() < self.mix.counters_ratio:
+                dgram.samples.append(self.counters_sample(agent))
+            else:
+                dgram.samples.append(self.flow_sample(agent))
+        return dgram
+
+    def datagrams(self, count: int) -> Iterator[bytes]:
+        for _ in range(count):
+            yield sflow.encode_datagram(self.datagram())
+
+
+# -- counter polling -----------------------------------------------------------
+
+
+@dataclass
+class FleetMix:
+    """A fleet of agents exporting counters on a fixed polling interval.
+
+    Each interface gets a link speed and a mean utilisation; every poll
+    moves its counters by that rate give or take `rate_noise`. Error and
+    discard counters stay flat except for occasional small bursts, as on a
+    healthy network. Every agent also reports processor counters.
+    """
+
+    seed: int = 1
+    agents: int = 16
+    interfaces_per_agent: int = 48
+    poll_intervals: Sequence[int] = (20_000, 30_000)  # ms
+    poll_jitter: int = 50  # ms, standard deviation
+    rate_noise: float = 0.1
+    error_bursts: float = 0.02  # probability per counter per poll
+    start_ms: int = 1_700_000_000_000
+
+
+@dataclass
+class _Interface:
+    if_index: int
+    speed: int
+    phase: int
+    in_rate: float  # bytes/s
+    out_rate: float
+    packet_size: int
+    counters: List[int]  # in/out octets, pkts, mcast, bcast, discards, errors
+    ethernet: List[int]
+
+
+class CounterFleet:
+    """Yields counters samples polled from a FleetMix, round by round."""
+
+    def __init__(self, mix: Optional[FleetMix] = None) -> None:
+        self.mix = mix or FleetMix()
+        self.rng = random.Random(self.mix.seed)
+        rng = self.rng
+        self.agents = []
+        for i in range(self.mix.agents):
+            address = struct.pack("!BBH", 10, 254, i + 1)
+            interval = rng.choice(self.mix.poll_intervals)
+            interfaces = [
+                self._make_interface(n + 1, interval)
+                for n in range(self.mix.interfaces_per_agent)
+            ]
+            cpu = rng.randrange(500, 4000)
+            self.agents.append([address, interval, interfaces, cpu, 1 << 34])
+
+    def _make_interface(self, if_index: int, interval: int) -> _Interface:
+        rng = self.rng
+        speed = rng.choice((1_000_000_000, 10_000_000_000, 100_000_000_000))
+        # most links are lightly loaded, a few run hot
+        util = min(rng.lognormvariate(-3.0, 1.0), 0.9)
+        in_rate = speed / 8 * util
+        out_rate = in_rate * rng.uniform(0.3, 1.5)
+        return _Interface(
+            if_index,
+            speed,
+            rng.randrange(interval),
+            in_rate,
+            out_rate,
+            rng.randint(300, 1200),
+            [rng.getrandbits(40), 0, 0, 0, 0, 0, rng.getrandbits(40), 0, 0, 0, 0, 0],
+            [0] * 13,
+        )
+
+    def _bump(self, value: int, mask: int) -> int:
+        if self.rng.random() < self.mix.error_bursts:
+            value = (value + self.rng.randint(1, 20)) & mask
+        return value
+
+    def _poll(self, iface: _Interface, seconds: float) -> List[sflow.Record]:
+        rng = self.rng
+        noise = self.mix.rate_noise
+        c = iface.counters
+        for base, rate in ((0, iface.in_rate), (6, iface.out_rate)):
+            octets = int(rate * seconds * rng.uniform(1 - noise, 1 + noise))
+            pkts = octets // iface.packet_size
+            c[base] += octets
+            c[base + 1] = (c[base + 1] + pkts) & 0xFFFFFFFF
+            c[base + 2] = (c[base + 2] + (pkts >> 10)) & 0xFFFFFFFF
+            c[base + 3] = (c[base + 3] + (pkts >> 14)) & 0xFFFFFFFF
+            c[base + 4] = self._bump(c[base + 4], 0xFFFFFFFF)
+            c[base + 5] = self._bump(c[base + 5], 0xFFFFFFFF)
+        iface.ethernet = [self._bump(v, 0xFFFFFFFF) for v in iface.ethernet]
+        if_counters = sflow.IfCounters(
+            iface.if_index,
+            6,
+            iface.speed,
+            1,
+            3,
+            c[0] & 0xFFFFFFFFFFFFFFFF,
+            c[1],
+            c[2],
+            c[3],
+            c[4],
+            c[5],
+            0,
+            c[6] & 0xFFFFFFFFFFFFFFFF,
+            c[7],
+            c[8],
+            c[9],
+            c[10],
+            c[11],
+            0,
+        )
+        return [
+            sflow.Record(sflow.COUNTERS_IF, if_counters),
+            sflow.Record(
+                sflow.COUNTERS_ETHERNET, sflow.EthernetCounters(*iface.ethernet)
+            ),
+        ]
+
+    def polls(self, rounds: int) -> Iterator[Tuple[int, bytes, sflow.CountersSample]]:
+        """Yield (timestamp_ms, agent address, sample) for `rounds` polls.
+
+        Samples come round by round, so each series is in time order while
+        the fleet as a whole is only roughly so.
+        """
+        rng = self.rng
+        start = self.mix.start_ms
+        jitter = self.mix.poll_jitter
+        for r in range(rounds):
+            for agent in self.agents:
+                address, interval, interfaces, cpu, free = agent
+                base = start + r * interval
+                for iface in interfaces:
+                    ts = base + iface.phase + int(rng.gauss(0, jitter))
+                    sample = sflow.CountersSample(r + 1, iface.if_index)
+                    sample.records = self._poll(iface, interval / 1000)
+                    yield ts, address, sample
+                cpu = max(0, min(10000, cpu + rng.randint(-200, 200)))
+                free = max(0, min(1 << 34, free + rng.randint(-1 << 20, 1 << 20)))
+                agent[3:] = [cpu, free]
+                sample = sflow.CountersSample(r + 1, 0)
+                sample.records = [
+                    sflow.Record(
+                        sflow.COUNTERS_PROCESSOR,
+                        sflow.ProcessorCounters(cpu, cpu, cpu, 1 << 35, free),
+                    )
+                ]
+                yield base + int(rng.gauss(0, jitter)), address, sample
+
+
+# -- IPFIX ---------------------------------------------------------------------
+
+IPFIX_TEMPLATE_V4 = Template(
+    256,
+    (
+        FieldSpec(ipfix.IE_SOURCE_IPV4_ADDRESS, 4),
+        FieldSpec(ipfix.IE_DESTINATION_IPV4_ADDRESS, 4),
+        FieldSpec(ipfix.IE_SOURCE_TRANSPORT_PORT, 2),
+        FieldSpec(ipfix.IE_DESTINATION_TRANSPORT_PORT, 2),
+        FieldSpec(ipfix.IE_PROTOCOL_IDENTIFIER, 1),
+        FieldSpec(ipfix.IE_TCP_CONTROL_BITS, 2),
+        FieldSpec(ipfix.IE_INGRESS_INTERFACE, 4),
+        FieldSpec(ipfix.IE_EGRESS_INTERFACE, 4),
+        FieldSpec(ipfix.IE_OCTET_DELTA_COUNT, 8),
+        FieldSpec(ipfix.IE_PACKET_DELTA_COUNT, 8),
+        FieldSpec(ipfix.IE_FLOW_START_MILLISECONDS, 8),
+        FieldSpec(ipfix.IE_FLOW_END_MILLISECONDS, 8),
+    ),
+)
+
+IPFIX_TEMPLATE_V6 = Template(
+    257,
+    (
+        FieldSpec(ipfix.IE_SOURCE_IPV6_ADDRESS, 16),
+        FieldSpec(ipfix.IE_DESTINATION_IPV6_ADDRESS, 16),
+        FieldSpec(ipfix.IE_SOURCE_TRANSPORT_PORT, 2),
+        FieldSpec(ipfix.IE_DESTINATION_TRANSPORT_PORT, 2),
+        FieldSpec(ipfix.IE_PROTOCOL_IDENTIFIER, 1),
+        FieldSpec(ipfix.IE_OCTET_DELTA_COUNT, 8),
+        FieldSpec(ipfix.IE_PACKET_DELTA_COUNT, 8),
+    ),
+)
+
+# variable-length and enterprise-specific fields
+IPFIX_TEMPLATE_APP = Template(
+    258,
+    (
+        FieldSpec(ipfix.IE_SOURCE_IPV4_ADDRESS, 4),
+        FieldSpec(ipfix.IE_APPLICATION_NAME, ipfix.VARLEN),
+        FieldSpec(1, 4, SYNTH_ENTERPRISE),
+        FieldSpec(2, ipfix.VARLEN, SYNTH_ENTERPRISE),
+        FieldSpec(ipfix.IE_OCTET_DELTA_COUNT, 8),
+    ),
+)
+
+
+@dataclass
+class IpfixMix:
+    """Shape of a synthetic IPFIX stream. `templates` maps each template to
+    its relative weight among data sets."""
+
+    seed: int = 1
+    domains: int = 4
+    templates: Dict[int, float] = field(default_factory=lambda: {256: 0.8, 257: 0.2})
+    template_defs: Sequence[Template] = (
+        IPFIX_TEMPLATE_V4,
+        IPFIX_TEMPLATE_V6,
+        IPFIX_TEMPLATE_APP,
+    )
+    records_per_set: int = 20
+    sets_per_message: int = 1
+    # resend templates every N messages per domain; 0 sends them only once
+    template_refresh: int = 64
+    export_time: int = 1_700_000_000
+
+
+class IpfixGenerator:
+    def __init__(self, mix: Optional[IpfixMix] = None) -> None:
+        self.mix = mix or IpfixMix()
+        self.rng = random.Random(self.mix.seed)
+        self.defs = {t.template_id: t for t in self.mix.template_defs}
+        self.sequence: Dict[int, int] = {}
+        self.messages_sent: Dict[int, int] = {}
+        self._ids = list(self.mix.templates)
+        self._weights = [self.mix.templates[i] for i in self._ids]
+
+    def _value(self, spec: FieldSpec):
+        if spec.length == ipfix.VARLEN:
+            n = self.rng.randint(0, 40)
+            return bytes(
+                self.rng.choice(b"abcdefghijklmnopqrstuvwxyz") for _ in range(n)
+            )
+        if spec.length <= 8:
+            return self.rng.getrandbits(8 * spec.length)
+        return self.rng.getrandbits(8 * spec.length).to_bytes(spec.length, "big")
+
+    def rows(self, template: Template, count: int) -> List[list]:
+        return [[self._value(f) for f in template.fields] for _ in range(count)]
+
+    def message(self, domain_id: Optional[int] = None) -> bytes:
+        if domain_id is None:
+            domain_id = self.rng.randrange(1, self.mix.domains + 1)
+        sent = self.messages_sent.get(domain_id, 0)
+        sets = []
+        refresh = self.mix.template_refresh
+        if sent == 0 or (refresh and sent % refresh == 0):
+            used = [self.defs[i] for i in self._ids]
+            sets.append(ipfix.encode_template_set(used))
+        nrecords = 0
+        for _ in range(self.mix.sets_per_message):
+            tid = self.rng.choices(self._ids, self._weights)[0]
+            sets.append(
+                ipfix.encode_data_set(
+                    self.defs[tid], self.rows(self.defs[tid], self.mix.records_per_set)
+                )
+            )
+            nrecords += self.mix.records_per_set
+        seq = self.sequence.get(domain_id, 0)
+        self.sequence[domain_id] = seq + nrecords
+        self.messages_sent[domain_id] = sent + 1
+        export_time = self.mix.export_time + sent
+        return ipfix.encode_message(sets, export_time, seq, domain_id)
+
+    def messages(self, count: int) -> Iterator[bytes]:
+        for _ in range(count):
+            yield self.message()
@@ -0,0 +1,467 @@
+"""sFlow to IPFIX translation.
+
+Decoded flow samples (sampled_header plus extended_switch, extended_router
+and extended_gateway) and if_counters blocks are mapped onto standard
+IPFIX Information Elements using a small fixed set of templates, one per
+record kind and agent address family. Records are packed straight into a
+preallocated, MTU-sized message body with struct.pack_into(); a finished
+message is handed to the sink as a list of segments (message header,
+template set when due, data sets) so a socket sink can write it with one
+scatter-gather sendmsg() and nothing is concatenated first.
+
+An if_counters block becomes two records, one per direction, told apart
+by flowDirection (0 ingress, 1 egress) and keyed by ingressInterface or
+egressInterface respectively:
+
+  octetTotalCount          ifInOctets / ifOutOctets (u64)
+  packetTotalCount         unicast + multicast + broadcast packets
+  droppedPacketTotalCount  ifInDiscards / ifOutDiscards
+
+sFlow carries the three packet counters as independently wrapping u32s,
+so their sum is sent modulo 2**32 in a 4-byte (reduced-size) field: a
+counter that wraps at 2**32 like the ones it is made of, whose deltas
+are correct modulo 2**32 whichever of them wrapped. Consumers must treat
+packet and discard totals as 32-bit wrapping counters, as they would the
+sFlow values themselves.
+"""
+
+import socket
+import struct
+import time
+from dataclasses import dataclass, fields
+from typing import Callable, Dict, Iterable, List, Optional
+
+from ipfix_parser import dissect, ipfix, sflow
+from ipfix_parser.ipfix import FieldSpec, Template
+
+DEFAULT_MTU = 1500
+# IPv6 + UDP headers, so messages fit whichever family carries them
+TRANSPORT_OVERHEAD = 48
+DEFAULT_TEMPLATE_REFRESH = 60.0  # seconds
+DEFAULT_MAX_DELAY = 0.5  # seconds a partial message may wait, see poll()
+
+IE_IP_NEXT_HOP_IPV6_ADDRESS = 62
+IE_BGP_NEXT_HOP_IPV4_ADDRESS = 18
+IE_BGP_NEXT_HOP_IPV6_ADDRESS = 63
+IE_SOURCE_IPV6_PREFIX_LENGTH = 29
+IE_DESTINATION_IPV6_PREFIX_LENGTH = 30
+IE_VLAN_ID = 58
+IE_POST_VLAN_ID = 59
+IE_OCTET_TOTAL_COUNT = 85
+IE_PACKET_TOTAL_COUNT = 86
+IE_EXPORTER_IPV4_ADDRESS = 130
+IE_EXPORTER_IPV6_ADDRESS = 131
+IE_DROPPED_PACKET_TOTAL_COUNT = 135
+IE_FLOW_DIRECTION = 61
+IE_SAMPLING_PACKET_INTERVAL = 305
+IE_OBSERVATION_TIME_MILLISECONDS = 323
+
+TEMPLATE_FLOW_V4_AGENT_V4 = 256
+TEMPLATE_FLOW_V4_AGENT_V6 = 257
+TEMPLATE_FLOW_V6_AGENT_V4 = 258
+TEMPLATE_FLOW_V6_AGENT_V6 = 259
+TEMPLATE_IF_IN_COUNTERS_AGENT_V4 = 260
+TEMPLATE_IF_IN_COUNTERS_AGENT_V6 = 261
+TEMPLATE_IF_OUT_COUNTERS_AGENT_V4 = 262
+TEMPLATE_IF_OUT_COUNTERS_AGENT_V6 = 263
+
+FLOW_DIRECTION_INGRESS = 0
+FLOW_DIRECTION_EGRESS = 1
+
+# (IE, length, struct code)
+_FLOW_COMMON_HEAD = (
+    (ipfix.IE_INGRESS_INTERFACE, 4, "I"),
+    (ipfix.IE_EGRESS_INTERFACE, 4, "I"),
+)
+_FLOW_V4 = (
+    (ipfix.IE_SOURCE_IPV4_ADDRESS, 4, "4s"),
+    (ipfix.IE_DESTINATION_IPV4_ADDRESS, 4, "4s"),
+    (ipfix.IE_PROTOCOL_IDENTIFIER, 1, "B"),
+    (ipfix.IE_IP_CLASS_OF_SERVICE, 1, "B"),
+    (ipfix.IE_SOURCE_TRANSPORT_PORT, 2, "H"),
+    (ipfix.IE_DESTINATION_TRANSPORT_PORT, 2, "H"),
+    (IE_VLAN_ID, 2, "H"),
+    (IE_POST_VLAN_ID, 2, "H"),
+    (ipfix.IE_IP_NEXT_HOP_IPV4_ADDRESS, 4, "4s"),
+    (ipfix.IE_SOURCE_IPV4_PREFIX_LENGTH, 1, "B"),
+    (ipfix.IE_DESTINATION_IPV4_PREFIX_LENGTH, 1, "B"),
+    (IE_BGP_NEXT_HOP_IPV4_ADDRESS, 4, "4s"),
+)
+_FLOW_V6 = (
+    (ipfix.IE_SOURCE_IPV6_ADDRESS, 16, "16s"),
+    (ipfix.IE_DESTINATION_IPV6_ADDRESS, 16, "16s"),
+    (ipfix.IE_PROTOCOL_IDENTIFIER, 1, "B"),
+    (ipfix.IE_IP_CLASS_OF_SERVICE, 1, "B"),
+    (ipfix.IE_SOURCE_TRANSPORT_PORT, 2, "H"),
+    (ipfix.IE_DESTINATION_TRANSPORT_PORT, 2, "H"),
+    (IE_VLAN_ID, 2, "H"),
+    (IE_POST_VLAN_ID, 2, "H"),
+    (IE_IP_NEXT_HOP_IPV6_ADDRESS, 16, "16s"),
+    (IE_SOURCE_IPV6_PREFIX_LENGTH, 1, "B"),
+    (IE_DESTINATION_IPV6_PREFIX_LENGTH, 1, "B"),
+    (IE_BGP_NEXT_HOP_IPV6_ADDRESS, 16, "16s"),
+)
+_FLOW_COMMON_TAIL = (
+    (ipfix.IE_BGP_SOURCE_AS_NUMBER, 4, "I"),
+    (ipfix.IE_BGP_DESTINATION_AS_NUMBER, 4, "I"),
+    (ipfix.IE_OCTET_DELTA_COUNT, 8, "Q"),
+    (ipfix.IE_PACKET_DELTA_COUNT, 8, "Q"),
+    (IE_SAMPLING_PACKET_INTERVAL, 4, "I"),
+    (IE_OBSERVATION_TIME_MILLISECONDS, 8, "Q"),
+)
+_IF_COUNTERS_TAIL = (
+    (IE_FLOW_DIRECTION, 1, "B"),
+    (IE_OCTET_TOTAL_COUNT, 8, "Q"),
+    # reduced size: 32-bit wrapping counters, see the module doc
+    (IE_PACKET_TOTAL_COUNT, 4, "I"),
+    (IE_DROPPED_PACKET_TOTAL_COUNT, 4, "I"),
+    (IE_OBSERVATION_TIME_MILLISECONDS, 8, "Q"),
+)
+_IF_IN_COUNTERS = ((ipfix.IE_INGRESS_INTERFACE, 4, "I"),) + _IF_COUNTERS_TAIL
+_IF_OUT_COUNTERS = ((ipfix.IE_EGRESS_INTERFACE, 4, "I"),) + _IF_COUNTERS_TAIL
+_AGENT_V4 = ((IE_EXPORTER_IPV4_ADDRESS, 4, "4s"),)
+_AGENT_V6 = ((IE_EXPORTER_IPV6_ADDRESS, 16, "16s"),)
+
+
+@dataclass
+class _Layout:
+    template: Template
+    record: struct.Struct
+
+
+def _layout(template_id: int, spec) -> _Layout:
+    template = Template(template_id, tuple(FieldSpec(ie, n) for ie, n, _ in spec))
+    return _Layout(template, struct.Struct("!" + "".join(c for _, _, c in spec)))
+
+
+LAYOUTS: Dict[int, _Layout] = {
+    tid: _layout(tid, spec)
+    for tid, spec in (
+        (
+            TEMPLATE_FLOW_V4_AGENT_V4,
+            _AGENT_V4 + _FLOW_COMMON_HEAD + _FLOW_V4 + _FLOW_COMMON_TAIL,
+        ),
+        (
+            TEMPLATE_FLOW_V4_AGENT_V6,
+            _AGENT_V6 + _FLOW_COMMON_HEAD + _FLOW_V4 + _FLOW_COMMON_TAIL,
+        ),
+        (
+            TEMPLATE_FLOW_V6_AGENT_V4,
+            _AGENT_V4 + _FLOW_COMMON_HEAD + _FLOW_V6 + _FLOW_COMMON_TAIL,
+        ),
+        (
+            TEMPLATE_FLOW_V6_AGENT_V6,
+            _AGENT_V6 + _FLOW_COMMON_HEAD + _FLOW_V6 + _FLOW_COMMON_TAIL,
+        ),
+        (TEMPLATE_IF_IN_COUNTERS_AGENT_V4, _AGENT_V4 + _IF_IN_COUNTERS),
+        (TEMPLATE_IF_IN_COUNTERS_AGENT_V6, _AGENT_V6 + _IF_IN_COUNTERS),
+        (TEMPLATE_IF_OUT_COUNTERS_AGENT_V4, _AGENT_V4 + _IF_OUT_COUNTERS),
+        (TEMPLATE_IF_OUT_COUNTERS_AGENT_V6, _AGENT_V6 + _IF_OUT_COUNTERS),
+    )
+}
+
+TEMPLATE_SET = ipfix.encode_template_set([lay.template for lay in LAYOUTS.values()])
+
+_SET_HEADER = struct.Struct("!HH")
+_ZERO_V4 = bytes(4)
+_ZERO_V6 = bytes(16)
+
+Sink = Callable[[List[memoryview]], None]
+
+
+def _interface(value: int) -> int:
+    # formats 1 (discarded) and 2 (multiple outputs) carry no ifIndex
+    return value & 0x3FFFFFFF if value >> 30 == 0 else 0
+
+
+def _addr(addr: bytes, size: int) -> bytes:
+    return addr if len(addr) == size else bytes(size)
+
+
+def socket_sink(sock: socket.socket) -> Sink:
+    """Write each message with a single gathering sendmsg().
+
+    Errors propagate as OSError; IpfixTranslator.flush() counts them.
+    """
+
+    def send(segments: List[memoryview]) -> None:
+        sock.sendmsg(segments)
+
+    return send
+
+
+@dataclass
+class TranslatorStats:
+    flow_records: int = 0
+    counter_records: int = 0
+    skipped_samples: int = 0
+    messages: int = 0
+    bytes: int = 0
+    template_sets: int = 0
+    send_errors: int = 0
+
+    def snapshot(self) -> Dict[str, int]:
+        return {f.name: getattr(self, f.name) for f in fields(self)}
+
+
+class IpfixTranslator:
+    """Batches translated records into MTU-sized IPFIX messages.
+
+    Segments passed to the sink point into buffers that are reused for
+    the next message, so a sink that keeps them must copy.
+    """
+
+    def __init__(
+        self,
+        sink: Sink,
+        domain_id: int = 0,
+        mtu: int = DEFAULT_MTU,
+        template_refresh: float = DEFAULT_TEMPLATE_REFRESH,
+        clock: Callable[[], float] = time.time,
+        max_delay: float = DEFAULT_MAX_DELAY,
+    ) -> None:
+        self.sink = sink
+        self.domain_id = domain_id
+        self.max_message = mtu - TRANSPORT_OVERHEAD
+        self.template_refresh = template_refresh
+        self.max_delay = max_delay
+        self.clock = clock
+        self.sequence_number = 0
+        self.stats = TranslatorStats()
+        self._header = bytearray(ipfix.MESSAGE_HEADER_LEN)
+        self._body = bytearray(self.max_message)
+        self._header_view = memoryview(self._header)
+        self._body_view = memoryview(self._body)
+        self._template_view = memoryview(TEMPLATE_SET)
+        self._templates_sent_at: Optional[float] = None
+        self._off = 0
+        self._records = 0
+        self._set_id = 0
+        self._set_start = 0
+        self._with_templates = False
+        self._budget = 0
+        self._started_at = 0.0
+
+    # -- message assembly ------------------------------------------------------
+
+    def _start_message(self) -> None:
+        # decided when the first record goes in, so an idle translator
+        # still refreshes templates with its next message
+        now = self._started_at = self.clock()
+        sent = self._templates_sent_at
+        self._with_templates = sent is None or now - sent >= self.template_refresh
+        budget = self.max_message - ipfix.MESSAGE_HEADER_LEN
+        if self._with_templates:
+            budget -= len(TEMPLATE_SET)
+        self._budget = budget
+        self._off = 0
+        self._records = 0
+        self._set_id = 0
+
+    def _close_set(self) -> None:
+        if self._set_id:
+            length = self._off - self._set_start
+            _SET_HEADER.pack_into(self._body, self._set_start, self._set_id, length)
+            self._set_id = 0
+
+    def flush(self) -> None:
+        """Emit the open message, if it holds any records."""
+        if not self._records:
+            return
+        self._close_set()
+        segments = [self._header_view]
+        length = ipfix.MESSAGE_HEADER_LEN + self._off
+        if self._with_templates:
+            segments.append(self._template_view)
+            length += len(TEMPLATE_SET)
+            self._templates_sent_at = self.clock()
+            self.stats.template_sets += 1
+        segments.append(self._body_view[: self._off])
+        struct.pack_into(
+            "!HHIII",
+            self._header,
+            0,
+            ipfix.IPFIX_VERSION,
+            length,
+            int(self.clock()),
+            self.sequence_number,
+            self.domain_id,
+        )
+        # lost records still count, so the collector sees the gap
+        self.sequence_number = (self.sequence_number + self._records) & 0xFFFFFFFF
+        self._records = 0
+        try:
+            self.sink(segments)
+        except OSError:
+            # e.g. ECONNREFUSED while the collector is down: drop this
+            # message and keep going, with templates in the next one
+            self.stats.send_errors += 1
+            if self._with_templates:
+                self._templates_sent_at = None
+            return
+        self.stats.messages += 1
+        self.stats.bytes += length
+
+    def poll(self) -> None:
+        """Flush the open message once its first record is `max_delay`
+        old, so a slow trickle of samples is not held back."""
+        if self._records and self.clock() - self._started_at >= self.max_delay:
+            self.flush()
+
+    def _append(self, template_id: int, values: tuple) -> None:
+        layout = LAYOUTS[template_id]
+        size = layout.record.size
+        if not self._records:
+            self._start_message()
+        need = size if self._set_id == template_id else size + ipfix.SET_HEADER_LEN
+        if self._off + need > self._budget:
+            self.flush()
+            self._start_message()
+        if self._set_id != template_id:
+            self._close_set()
+            self._set_id = template_id
+            self._set_start = self._off
+            self._off += ipfix.SET_HEADER_LEN
+        layout.record.pack_into(self._body, self._off, *values)
+        self._off += size
+        self._records += 1
+
+    # -- record mapping -----------------------------------------------------------
+
+    def add_flow_sample(
+        self,
+        agent: bytes,
+        sample: sflow.FlowSample,
+        key: Optional[dissect.Dissection] = None,
+        now_ms: int = 0,
+    ) -> bool:
+        if key is None:
+            key = dissect.dissect_flow_sample(sample)
+        if key is None or key.ethertype not in (
+            dissect.ETHERTYPE_IPV4,
+            dissect.ETHERTYPE_IPV6,
+        ):
+            self.stats.skipped_samples += 1
+            return False
+        v6 = key.ethertype == dissect.ETHERTYPE_IPV6
+        agent_v6 = len(agent) == 16
+        size = 16 if v6 else 4
+        zero = _ZERO_V6 if v6 else _ZERO_V4
+
+        src_vlan = dst_vlan = key.vlan
+        nexthop = bgp_nexthop = zero
+        src_mask = dst_mask = 0
+        src_as = dst_as = 0
+        for rec in sample.records:
+            fmt, data = rec.data_format, rec.data
+            if fmt == sflow.FLOW_EXT_SWITCH:
+                src_vlan, dst_vlan = data.src_vlan, data.dst_vlan
+            elif fmt == sflow.FLOW_EXT_ROUTER:
+                nexthop = _addr(data.nexthop, size)
+                src_mask, dst_mask = data.src_mask_len, data.dst_mask_len
+            elif fmt == sflow.FLOW_EXT_GATEWAY:
+                bgp_nexthop = _addr(data.nexthop, size)
+                src_as = data.src_as
+                # destination AS is the last hop of the path when present
+                dst_as = data.as_number
+                if data.dst_as_path and data.dst_as_path[-1][1]:
+                    dst_as = data.dst_as_path[-1][1][-1]
+
+        rate = sample.sampling_rate
+        if v6:
+            template_id = (
+                TEMPLATE_FLOW_V6_AGENT_V6 if agent_v6 else TEMPLATE_FLOW_V6_AGENT_V4
+            )
+        else:
+            template_id = (
+                TEMPLATE_FLOW_V4_AGENT_V6 if agent_v6 else TEMPLATE_FLOW_V4_AGENT_V4
+            )
+        self._append(
+            template_id,
+            (
+                agent,
+                _interface(sample.input),
+                _interface(sample.output),
+                _addr(key.src_ip, size),
+                _addr(key.dst_ip, size),
+                key.protocol,
+                key.tos & 0xFF,
+                key.src_port,
+                key.dst_port,
+                src_vlan & 0xFFFF,
+                dst_vlan & 0xFFFF,
+                nexthop,
+                src_mask & 0xFF,
+                dst_mask & 0xFF,
+                bgp_nexthop,
+                src_as,
+                dst_as,
+                dissect.frame_length(sample) * rate,
+                rate,
+                rate,
+                now_ms,
+            ),
+        )
+        self.stats.flow_records += 1
+        return True
+
+    def add_counters_sample(
+        self, agent: bytes, sample: sflow.CountersSample, now_ms: int = 0
+    ) -> bool:
+        ifc = sample.record(sflow.COUNTERS_IF)
+        if ifc is None:
+            self.stats.skipped_samples += 1
+            return False
+        if len(agent) == 16:
+            agent = _addr(agent, 16)
+            in_id = TEMPLATE_IF_IN_COUNTERS_AGENT_V6
+            out_id = TEMPLATE_IF_OUT_COUNTERS_AGENT_V6
+        else:
+            agent = _addr(agent, 4)
+            in_id = TEMPLATE_IF_IN_COUNTERS_AGENT_V4
+            out_id = TEMPLATE_IF_OUT_COUNTERS_AGENT_V4
+        for template_id, direction, octets, packets, discards in (
+            (
+                in_id,
+                FLOW_DIRECTION_INGRESS,
+                ifc.in_octets,
+                ifc.in_ucast_pkts + ifc.in_multicast_pkts + ifc.in_broadcast_pkts,
+                ifc.in_discards,
+            ),
+            (
+                out_id,
+                FLOW_DIRECTION_EGRESS,
+                ifc.out_octets,
+                ifc.out_ucast_pkts + ifc.out_multicast_pkts + ifc.out_broadcast_pkts,
+                ifc.out_discards,
+            ),
+        ):
+            self._append(
+                template_id,
+                (
+                    agent,
+                    ifc.if_index,
+                    direction,
+                    octets,
+                    packets & 0xFFFFFFFF,
+                    discards,
+                    now_ms,
+                ),
+            )
+        self.stats.counter_records += 2
+        return True
+
+    def translate(self, items: Iterable) -> None:
+        """Translate pipeline AgentSamples (anything with agent_address,
+        sample and key attributes). A partial message goes out on flush(),
+        or on poll() once it is max_delay old."""
+        now_ms = int(self.clock() * 1000)
+        for item in items:
+            sample = item.sample
+            agent = _addr(
+                item.agent_address, 16 if len(item.agent_address) == 16 else 4
+            )
+            if isinstance(sample, sflow.FlowSample):
+                self.add_flow_sample(agent, sample, item.key, now_ms)
+            elif isinstance(sample, sflow.CountersSample):
+                self.add_counters_sample(agent, sample, now_ms)
@@ -0,0 +1,642 @@
+"""Compressed time-series store for sFlow interface counters.
+
+One series is kept per (agent, source_id, counter format) and holds the
+fields of that counter block (if_counters, ethernet_counters, ...) as
+columns next to a millisecond timestamp column. Rows are buffered per
+series, packed in their wire layout, and written as blocks of up to
+BLOCK_ROWS rows, compressed column by column:
+
+  timestamps  first value, first delta, then zigzag delta-of-deltas
+  counters    first value, then zigzag deltas
+
+each bit-packed at the narrowest width that fits the block. Blocks are
+appended to a single file which is read back through mmap. A block
+header describes its series, so the index is rebuilt by walking the
+headers when the store is reopened.
+
+Rows waiting for their block are also mirrored into a tail file next to
+the store (`path` + ".tail"), mapped with mmap so that mirroring a row is
+a memory copy rather than a system call. Each series has a slot there
+holding up to BLOCK_ROWS rows and their count, and reopening the store
+after a crash reloads the slots into the buffers. That lets partial
+blocks wait until they fill: at a 20-30 s polling interval a 128-row
+block spans about an hour, and a crashed process loses none of it. Like
+the block file, the tail is not fsync()ed, so a power loss can still
+cost what the OS had not written back. A clean close() writes the
+partial blocks and removes the tail.
+
+Partial blocks are written early only when asked: `max_age_ms` writes a
+block once its first row is that much older than the newest row
+appended (off by default), and the oldest partial blocks are written
+whenever the buffered rows of all series exceed `max_buffered` bytes.
+Short blocks compress less well.
+
+A failed write (a full disk, say) is counted in `write_errors` and its
+rows stay buffered; writes are retried once the rows appended have moved
+WRITE_RETRY_MS past the failure. Should the disk stay unavailable, the
+oldest buffered rows are dropped to keep within `max_buffered`.
+
+Scans decode a whole column of a block at once: the packed bits are
+turned into one integer with int.from_bytes() and the prefix sums run in
+itertools.accumulate(), keeping per-value work out of the interpreter as
+far as Python allows (there is no SIMD to reach from here).
+"""
+
+import errno
+import itertools
+import mmap
+import os
+import struct
+import time
+from dataclasses import dataclass, field
+from typing import Dict, Iterable, Iterator, List, Optional, Sequence, Tuple
+
+from ipfix_parser import sflow
+
+BLOCK_ROWS = 128
+DEFAULT_MAX_AGE_MS: Optional[int] = None  # blocks fill; see the tail file
+DEFAULT_MAX_BUFFERED = 256 << 20  # bytes of rows not yet in a block
+WRITE_RETRY_MS = 30 * 1000
+BLOCK_MAGIC = b"TSB1"
+TAIL_MAGIC = b"TST1"
+TAIL_SUFFIX = ".tail"
+
+_U64_MASK = (1 << 64) - 1
+
+# magic, block length, counter format, source_id, agent length, agent,
+# rows, columns
+_BLOCK_HEADER = struct.Struct("!4sIIIB16sHH")
+# first timestamp, zigzag first delta, delta-of-delta width
+_TS_HEADER = struct.Struct("!QQB")
+# each column: first value (mod 2**64) as a LEB128 varint, then one byte
+# of zigzag delta width
+
+# tail slot: magic, counter format, source_id, agent length, agent,
+# capacity, rows; then `capacity` rows packed with the series' row struct
+_TAIL_SLOT = struct.Struct("!4sIIB16sHH")
+_TAIL_ROWS = struct.Struct("!H")
+_TAIL_ROWS_OFFSET = _TAIL_SLOT.size - _TAIL_ROWS.size
+_TAIL_GROWTH = 1 << 20  # bytes the tail file is extended by, at least
+
+SeriesKey = Tuple[bytes, int, int]  # agent, source_id, counter format
+
+
+def zigzag(v: int) -> int:
+    return v << 1 if v >= 0 else ((-v) << 1) - 1
+
+
+def unzigzag(z: int) -> int:
+    return (z >> 1) ^ -(z & 1)
+
+
+def encode_varint(v: int) -> bytes:
+    out = bytearray()
+    while v > 0x7F:
+        out.append(v & 0x7F | 0x80)
+        v >>= 7
+    out.append(v)
+    return bytes(out)
+
+
+def decode_varint(buf, off: int) -> Tuple[int, int]:
+    v = shift = 0
+    while True:
+        b = buf[off]
+        off += 1
+        v |= (b & 0x7F) << shift
+        if b < 0x80:
+            return v, off
+        shift += 7
+
+
+def pack_bits(values: Sequence[int], width: int) -> bytes:
+    """Pack non-negative ints, `width` bits each, least significant first."""
+    if not width or not values:
+        return b""
+    acc = 0
+    for v in reversed(values):
+        acc = (acc << width) | v
+    return acc.to_bytes((len(values) * width + 7) // 8, "little")
+
+
+def unpack_bits(buf, off: int, count: int, width: int) -> List[int]:
+    if not width:
+        return [0] * count
+    nbytes = (count * width + 7) // 8
+    acc = int.from_bytes(buf[off : off + nbytes], "little")
+    mask = (1 << width) - 1
+    return [(acc >> shift) & mask for shift in range(0, count * width, width)]
+
+
+def packed_size(count: int, width: int) -> int:
+    return (count * width + 7) // 8
+
+
+def _signed_columns(counter_format: int) -> Tuple[bool, ...]:
+    st = sflow.COUNTER_FORMATS[counter_format][0]
+    return tuple(code.islower() for code in sflow.struct_codes(st))
+
+
+def _row_struct(counter_format: int) -> struct.Struct:
+    st = sflow.COUNTER_FORMATS[counter_format][0]
+    # native order and no padding: the buffer never leaves the process
+    return struct.Struct("=Q" + st.format.lstrip("!"))
+
+
+def encode_block(key: SeriesKey, timestamps: Sequence[int], columns) -> bytes:
+    agent, source_id, counter_format = key
+    rows = len(timestamps)
+    out = [b""]
+
+    t0 = timestamps[0]
+    deltas = [b - a for a, b in zip(timestamps, timestamps[1:])]
+    d0 = deltas[0] if deltas else 0
+    dods = [zigzag(b - a) for a, b in zip(deltas, deltas[1:])]
+    width = max(dods, default=0).bit_length()
+    out.append(_TS_HEADER.pack(t0, zigzag(d0), width))
+    out.append(pack_bits(dods, width))
+
+    for col in columns:
+        zs = [zigzag(b - a) for a, b in zip(col, col[1:])]
+        width = max(zs, default=0).bit_length()
+        out.append(encode_varint(col[0] & _U64_MASK))
+        out.append(bytes((width,)))
+        out.append(pack_bits(zs, width))
+
+    body_len = sum(len(part) for part in out)
+    out[0] = _BLOCK_HEADER.pack(
+        BLOCK_MAGIC,
+        _BLOCK_HEADER.size + body_len,
+        counter_format,
+        source_id,
+        len(agent),
+        agent,
+        rows,
+        len(columns),
+    )
+    return b"".join(out)
+
+
+@dataclass
+class BlockRef:
+    offset: int
+    rows: int
+    first_ts: int
+    last_ts: int
+
+
+@dataclass
+class _Series:
+    key: SeriesKey
+    signed: Tuple[bool, ...]
+    row: struct.Struct  # timestamp, then the counter block
+    blocks: List[BlockRef] = field(default_factory=list)
+    # rows not yet in a block, packed with `row`
+    buffer: bytearray = field(default_factory=bytearray)
+    first_ts: int = 0  # of the first buffered row
+    slot: int = -1  # offset of its slot in the tail file, -1 for none
+    capacity: int = 0  # rows the slot holds
+
+
+@dataclass
+class StoreStats:
+    rows: int = 0
+    blocks: int = 0
+    raw_bytes: int = 0
+    stored_bytes: int = 0
+    write_errors: int = 0
+    rows_dropped: int = 0  # buffered while writes failed, over the budget
+    rows_recovered: int = 0  # reloaded from the tail file on open
+
+    @property
+    def compression_ratio(self) -> float:
+        return self.raw_bytes / self.stored_bytes if self.stored_bytes else 0.0
+
+
+class CounterStore:
+    """Append-only store of counter series backed by one mmapped file,
+    plus the tail file mirroring rows not yet in a block.
+
+    With the default `max_age_ms=None` partial blocks stay buffered until
+    they fill up, the memory budget is exceeded or flush() is called.
+    """
+
+    def __init__(
+        self,
+        path: str,
+        block_rows: int = BLOCK_ROWS,
+        max_age_ms: Optional[int] = DEFAULT_MAX_AGE_MS,
+        max_buffered: int = DEFAULT_MAX_BUFFERED,
+    ) -> None:
+        self.path = path
+        self.block_rows = block_rows
+        self.max_age_ms = max_age_ms
+        self.max_buffered = max_buffered
+        self.series: Dict[SeriesKey, _Series] = {}
+        self.stats = StoreStats()
+        self.buffered_bytes = 0
+        self._sweep_at = 0
+        self._now = 0  # newest timestamp appended
+        self._retry_at = 0  # no writes before this, after a failed one
+        self._fd = os.open(path, os.O_RDWR | os.O_CREAT | os.O_APPEND, 0o644)
+        self._size = os.fstat(self._fd).st_size
+        self._map: Optional[mmap.mmap] = None
+        self.tail_path = path + TAIL_SUFFIX
+        self._tail_fd = os.open(self.tail_path, os.O_RDWR | os.O_CREAT, 0o644)
+        self._tail_size = os.fstat(self._tail_fd).st_size
+        self._tail: Optional[mmap.mmap] = None
+        self._tail_used = 0
+        self._load_index()
+        self._load_tail()
+
+    def close(self) -> None:
+        flushed = self.flush()
+        if self._map is not None:
+            self._map.close()
+            self._map = None
+        os.close(self._fd)
+        if self._tail is not None:
+            self._tail.close()
+            self._tail = None
+        os.close(self._tail_fd)
+        if flushed:
+            # every row is in a block; only a crash leaves a tail behind
+            os.unlink(self.tail_path)
+
+    def __enter__(self) -> "CounterStore":
+        return self
+
+    def __exit__(self, *exc) -> None:
+        self.close()
+
+    # -- file access -------------------------------------------------------------
+
+    def _view(self) -> mmap.mmap:
+        """Map the file, remapping when blocks were appended since."""
+        if self._map is None or len(self._map) < self._size:
+            if self._map is not None:
+                self._map.close()
+            self._map = mmap.mmap(self._fd, self._size, access=mmap.ACCESS_READ)
+        return self._map
+
+    def _series(self, key: SeriesKey) -> _Series:
+        series = self.series.get(key)
+        if series is None:
+            series = _Series(key, _signed_columns(key[2]), _row_struct(key[2]))
+            self.series[key] = series
+        return series
+
+    def _load_index(self) -> None:
+        if not self._size:
+            return
+        buf = self._view()
+        off = 0
+        while off + _BLOCK_HEADER.size <= self._size:
+            magic, length, fmt, source_id, alen, agent, rows, ncols = (
+                _BLOCK_HEADER.unpack_from(buf, off)
+            )
+            if magic != BLOCK_MAGIC or off + length > self._size:
+                break
+            ts = self._decode_timestamps(buf, off + _BLOCK_HEADER.size, rows)[0]
+            series = self._series((agent[:alen], source_id, fmt))
+            series.blocks.append(BlockRef(off, rows, ts[0], ts[-1]))
+            self.stats.blocks += 1
+            self.stats.rows += rows
+            self.stats.stored_bytes += length
+            self.stats.raw_bytes += rows * self._raw_row_size(fmt)
+            off += length
+        if off < self._size:
+            # a torn final write: cut it off so appends follow the last
+            # good block instead of the garbage
+            os.ftruncate(self._fd, off)
+            self._size = off
+            self._map.close()
+            self._map = None
+
+    def _load_tail(self) -> None:
+        """Reload the rows a previous process left in the tail file."""
+        if not self._tail_size:
+            return
+        tail = self._tail = mmap.mmap(self._tail_fd, self._tail_size)
+        off = 0
+        while off + _TAIL_SLOT.size <= self._tail_size:
+            magic, fmt, source_id, alen, agent, capacity, rows = _TAIL_SLOT.unpack_from(
+                tail, off
+            )
+            if magic != TAIL_MAGIC or fmt not in sflow.COUNTER_FORMATS:
+                break
+            series = self._series((agent[:alen], source_id, fmt))
+            size = series.row.size
+            start = off + _TAIL_SLOT.size
+            if start + capacity * size > self._tail_size:
+                break
+            series.slot = off
+            series.capacity = capacity
+            data = tail[start : start + min(rows, capacity) * size]
+            skip = self._already_written(series, data)
+            if data[skip:]:
+                series.buffer += data[skip:]
+                series.first_ts = series.row.unpack_from(series.buffer)[0]
+                self.buffered_bytes += len(data) - skip
+                self.stats.rows_recovered += (len(data) - skip) // size
+            if skip:
+                self._mirror(series)
+            off = start + capacity * size
+        self._tail_used = off
+
+    @staticmethod
+    def _already_written(series: _Series, data: bytes) -> int:
+        """Bytes at the start of a slot that its series' last block holds
+        already: a crash between writing a block and emptying the slot
+        leaves them in both."""
+        if not series.blocks or not data:
+            return 0
+        ref = series.blocks[-1]
+        size = series.row.size
+        if ref.rows * size > len(data):
+            return 0
+        first = series.row.unpack_from(data)[0]
+        last = series.row.unpack_from(data, (ref.rows - 1) * size)[0]
+        return ref.rows * size if (first, last) == (ref.first_ts, ref.last_ts) else 0
+
+    def _add_slot(self, series: _Series) -> bool:
+        capacity = min(self.block_rows, 0xFFFF)
+        end = self._tail_used + _TAIL_SLOT.size + capacity * series.row.size
+        if end > self._tail_size:
+            size = max(end, 2 * self._tail_size, _TAIL_GROWTH)
+            try:
+                # allocated up front, or a full disk would raise SIGBUS
+                # from a store into the mapping instead of an error here
+                os.posix_fallocate(
+                    self._tail_fd, self._tail_size, size - self._tail_size
+                )
+            except OSError:
+                self.stats.write_errors += 1
+                self._retry_at = self._now + WRITE_RETRY_MS
+                return False
+            if self._tail is not None:
+                self._tail.close()
+            self._tail = mmap.mmap(self._tail_fd, size)
+            self._tail_size = size
+        agent, source_id, counter_format = series.key
+        _TAIL_SLOT.pack_into(
+            self._tail,
+            self._tail_used,
+            TAIL_MAGIC,
+            counter_format,
+            source_id,
+            len(agent),
+            agent,
+            capacity,
+            0,
+        )
+        series.slot = self._tail_used
+        series.capacity = capacity
+        self._tail_used = end
+        self._mirror(series)
+        return True
+
+    def _mirror(self, series: _Series) -> None:
+        """Copy the start of the buffer into the series' slot. The count
+        is cleared first and set last, so a crash midway never pairs it
+        with rows from another generation."""
+        if series.slot < 0:
+            return
+        tail = self._tail
+        rows = min(len(series.buffer) // series.row.size, series.capacity)
+        nbytes = rows * series.row.size
+        start = series.slot + _TAIL_SLOT.size
+        _TAIL_ROWS.pack_into(tail, series.slot + _TAIL_ROWS_OFFSET, 0)
+        tail[start : start + nbytes] = series.buffer[:nbytes]
+        _TAIL_ROWS.pack_into(tail, series.slot + _TAIL_ROWS_OFFSET, rows)
+
+    @staticmethod
+    def _raw_row_size(counter_format: int) -> int:
+        # timestamp plus the counter block as it arrives on the wire
+        return 8 + sflow.COUNTER_FORMATS[counter_format][0].size
+
+    # -- ingest --------------------------------------------------------------------
+
+    def append(self, key: SeriesKey, timestamp_ms: int, values: Sequence[int]) -> None:
+        series = self._series(key)
+        if len(values) != len(series.signed):
+            raise ValueError(f"expected {len(series.signed)} values for {key}")
+        size = series.row.size
+        rows = len(series.buffer) // size
+        if not rows:
+            series.first_ts = timestamp_ms
+        row = series.row.pack(timestamp_ms, *values)
+        series.buffer += row
+        self.buffered_bytes += size
+        self._now = max(self._now, timestamp_ms)
+        if rows < series.capacity:
+            # the row first, then the count that makes it part of the slot
+            start = series.slot + _TAIL_SLOT.size + rows * size
+            self._tail[start : start + size] = row
+            _TAIL_ROWS.pack_into(self._tail, series.slot + _TAIL_ROWS_OFFSET, rows + 1)
+        elif series.slot < 0 and self._now >= self._retry_at:
+            self._add_slot(series)
+        if self._now < self._retry_at:
+            if self.buffered_bytes > self.max_buffered:
+                self._drop_oldest()
+            return
+        if len(series.buffer) >= series.row.size * self.block_rows:
+            self._write_block(series)
+        elif self.buffered_bytes > self.max_buffered:
+            self._write_oldest()
+        if self.max_age_ms is not None and timestamp_ms >= self._sweep_at:
+            # sweeping visits every series, so only every 1/8 of the age
+            self._sweep_at = timestamp_ms + self.max_age_ms // 8
+            self.flush(older_than_ms=timestamp_ms - self.max_age_ms)
+
+    def ingest_sample(
+        self, agent_address: bytes, sample: sflow.CountersSample, timestamp_ms: int
+    ) -> None:
+        """Append every decoded counter block of one counters_sample."""
+        for rec in sample.records:
+            if rec.data_format in sflow.COUNTER_FORMATS and not isinstance(
+                rec.data, bytes
+            ):
+                key = (agent_address, sample.source_id, rec.data_format)
+                self.append(key, timestamp_ms, rec.data)
+
+    def ingest_samples(
+        self, items: Iterable, timestamp_ms: Optional[int] = None
+    ) -> None:
+        """Pipeline counters_sink: append a batch of AgentSamples.
+
+        sFlow counters carry no timestamp of their own, so samples are
+        stamped with the collector's clock when the batch arrives.
+        """
+        if timestamp_ms is None:
+            timestamp_ms = int(time.time() * 1000)
+        for item in items:
+            if isinstance(item.sample, sflow.CountersSample):
+                self.ingest_sample(item.agent_address, item.sample, timestamp_ms)
+
+    def _append_bytes(self, data: bytes) -> int:
+        """Append data at the end of the file and return its offset. On
+        failure the file is cut back, so nothing partial is left behind."""
+        offset = self._size
+        view = memoryview(data)
+        try:
+            while view:
+                n = os.write(self._fd, view)
+                if n <= 0:
+                    raise OSError(errno.EIO, "short write", self.path)
+                view = view[n:]
+        except OSError:
+            os.ftruncate(self._fd, offset)
+            raise
+        self._size += len(data)
+        return offset
+
+    def _write_block(self, series: _Series) -> bool:
+        """Write the rows buffered for `series` as blocks of at most
+        block_rows. On a write error the rows not yet written stay
+        buffered and False is returned."""
+        step = series.row.size * self.block_rows
+        buf = series.buffer
+        done = 0
+        try:
+            while done < len(buf):
+                chunk = buf[done : done + step]
+                timestamps, *columns = zip(*series.row.iter_unpack(chunk))
+                block = encode_block(series.key, timestamps, columns)
+                offset = self._append_bytes(block)
+                rows = len(timestamps)
+                series.blocks.append(
+                    BlockRef(offset, rows, timestamps[0], timestamps[-1])
+                )
+                self.stats.blocks += 1
+                self.stats.rows += rows
+                self.stats.stored_bytes += len(block)
+                self.stats.raw_bytes += rows * self._raw_row_size(series.key[2])
+                done += len(chunk)
+        except OSError:
+            self.stats.write_errors += 1
+            self._retry_at = self._now + WRITE_RETRY_MS
+            return False
+        finally:
+            if done:
+                self.buffered_bytes -= done
+                del buf[:done]
+                if buf:
+                    series.first_ts = series.row.unpack_from(buf)[0]
+                self._mirror(series)
+        return True
+
+    def _pending(self) -> List[_Series]:
+        return sorted(
+            (s for s in self.series.values() if s.buffer), key=lambda s: s.first_ts
+        )
+
+    def _write_oldest(self) -> None:
+        """Write partial blocks, oldest first, down to half the budget."""
+        for series in self._pending():
+            if self.buffered_bytes <= self.max_buffered // 2:
+                break
+            if not self._write_block(series):
+                self._drop_oldest()
+                break
+
+    def _drop_oldest(self) -> None:
+        """Writes are failing: drop buffered rows, oldest series first,
+        down to half the budget."""
+        for series in self._pending():
+            if self.buffered_bytes <= self.max_buffered // 2:
+                break
+            self.stats.rows_dropped += len(series.buffer) // series.row.size
+            self.buffered_bytes -= len(series.buffer)
+            series.buffer = bytearray()
+            self._mirror(series)
+
+    def flush(self, older_than_ms: Optional[int] = None) -> bool:
+        """Write every partially filled block, or only those whose first
+        row is at or before `older_than_ms`. Stops at the first write
+        error and returns False."""
+        for series in self.series.values():
+            if series.buffer and (
+                older_than_ms is None or series.first_ts <= older_than_ms
+            ):
+                if not self._write_block(series):
+                    return False
+        return True
+
+    # -- scans ---------------------------------------------------------------------
+
+    @staticmethod
+    def _decode_timestamps(buf, off: int, rows: int) -> Tuple[List[int], int]:
+        t0, zd0, width = _TS_HEADER.unpack_from(buf, off)
+        off += _TS_HEADER.size
+        dods = unpack_bits(buf, off, max(rows - 2, 0), width)
+        off += packed_size(max(rows - 2, 0), width)
+        if rows == 1:
+            return [t0], off
+        deltas = itertools.accumulate(map(unzigzag, dods), initial=unzigzag(zd0))
+        return list(itertools.accumulate(deltas, initial=t0)), off
+
+    @staticmethod
+    def _decode_column(buf, off: int, rows: int, signed: bool) -> Tuple[List[int], int]:
+        v0, off = decode_varint(buf, off)
+        width = buf[off]
+        off += 1
+        zs = unpack_bits(buf, off, rows - 1, width)
+        off += packed_size(rows - 1, width)
+        if signed and v0 >> 63:
+            v0 -= 1 << 64
+        return list(itertools.accumulate(map(unzigzag, zs), initial=v0)), off
+
+    @staticmethod
+    def _skip_column(buf, off: int, rows: int) -> int:
+        off = decode_varint(buf, off)[1]
+        return off + 1 + packed_size(rows - 1, buf[off])
+
+    def _decode_block(
+        self, series: _Series, ref: BlockRef, wanted: Optional[Sequence[int]]
+    ) -> Tuple[List[int], Dict[int, List[int]]]:
+        buf = self._view()
+        off = ref.offset + _BLOCK_HEADER.size
+        timestamps, off = self._decode_timestamps(buf, off, ref.rows)
+        columns = {}
+        last = max(wanted) if wanted is not None else len(series.signed) - 1
+        for i, signed in enumerate(series.signed[: last + 1]):
+            if wanted is None or i in wanted:
+                columns[i], off = self._decode_column(buf, off, ref.rows, signed)
+            else:
+                off = self._skip_column(buf, off, ref.rows)
+        return timestamps, columns
+
+    def scan(
+        self,
+        key: SeriesKey,
+        start_ms: int = 0,
+        end_ms: int = 1 << 63,
+        fields: Optional[Sequence[str]] = None,
+    ) -> Iterator[Tuple[int, tuple]]:
+        """Yield (timestamp_ms, values) for rows with start <= ts < end.
+
+        `fields` limits decoding to the named columns; columns that are not
+        requested are skipped without being unpacked.
+        """
+        series = self.series.get(key)
+        if series is None:
+            return
+        names = sflow.COUNTER_FORMATS[key[2]][1]._fields
+        wanted = None
+        if fields is not None:
+            wanted = [names.index(name) for name in fields]
+        for ref in series.blocks:
+            if ref.last_ts < start_ms or ref.first_ts >= end_ms:
+                continue
+            timestamps, columns = self._decode_block(series, ref, wanted)
+            order = wanted if wanted is not None else range(len(series.signed))
+            cols = [columns[i] for i in order]
+            for row, ts in enumerate(timestamps):
+                if start_ms <= ts < end_ms:
+                    yield ts, tuple(col[row] for col in cols)
+        # rows still buffered in memory
+        order = wanted if wanted is not None else range(len(series.signed))
+        for ts, *values in series.row.iter_unpack(series.buffer):
+            if start_ms <= ts < end_ms:
+                yield ts, tuple(values[i] for i in order)
@@ -0,0 +1,134 @@
+import dataclasses
+
+from ipfix_parser import checkpoint, ipfix, pipeline, sflow, synth
+from tests.test_sflow import (
+    counters_sample,
+    datagram,
+    eth_ipv4_udp,
+    flow_sample,
+    sampled_ipv4_flow_sample,
+)
+
+
+def test_cow_table_freeze_leaves_snapshot_untouched():
+    table = checkpoint.CowTable(copy=dataclasses.replace)
+    for i in range(4):
+        table[i] = pipeline.FlowAggregate(b"a", i, 0, None, bytes=i)
+    table.request_freeze()
+    table.poll()
+    frozen = table.frozen
+    assert sorted(frozen) == [0, 1, 2, 3]
+
+    table.get(1).bytes += 100  # copied on first touch
+    table[4] = pipeline.FlowAggregate(b"a", 4, 0, None)
+    table.pop(2)
+    assert frozen[1].bytes == 1
+    assert sorted(frozen) == [0, 1, 2, 3]
+    assert sorted(k for k, _ in table.items()) == [0, 1, 3, 4]
+
+    table.release()
+    table.poll()
+    assert table.frozen is None
+    assert sorted(k for k, _ in table.items()) == [0, 1, 3, 4]
+    assert table.get(1).bytes == 101
+
+    table.request_freeze()
+    table.poll()
+    table.clear()
+    assert len(table) == 0 and len(table.frozen) == 4
+    table.release()
+    table.poll()
+    assert len(table) == 0
+
+
+def test_restart_resumes_from_snapshot(tmp_path):
+    path = str(tmp_path / "collector.ckp")
+    pkt = eth_ipv4_udp(b"\x0a\x00\x00\x02", b"\x0a\x00\x00\x03", 1234, 53)
+    batch = [
+        (datagram([flow_sample(seq, 10, 1000, pkt)], seq), None) for seq in (1, 2, 4)
+    ]
+    batch.append((datagram([counters_sample(1, 5000)], 5), None))
+
+    p = pipeline.Pipeline(exporter=lambda window: None, window=60.0)
+    p.aggregate_batch(p.dissect_batch(p.decode_batch(batch)))
+    cache = p.template_caches.setdefault("10.0.0.9:4739", ipfix.TemplateCache())
+    for data in synth.IpfixGenerator().messages(3):
+        ipfix.decode_message(data, cache)
+    assert p.metrics.datagrams_lost == 1
+    p.checkpoint(path)
+
+    q = pipeline.Pipeline(exporter=lambda window: None, window=60.0)
+    snap = q.restore(path)
+    assert snap.epoch == 1
+    assert dict(q.agent_sequences.items()) == dict(p.agent_sequences.items())
+    assert dict(q.if_counters.items()) == dict(p.if_counters.items())
+    assert [dataclasses.astuple(a) for a in q._flows.values()] == [
+        dataclasses.astuple(a) for a in p._flows.values()
+    ]
+    restored = q.template_caches["10.0.0.9:4739"]
+    assert restored.templates == cache.templates
+
+    # baselines carry over: a gap and a counter reset are both noticed
+    later = [
+        (datagram([flow_sample(9, 10, 1000, pkt)], 8), None),
+        (datagram([counters_sample(2, 10)], 9), None),
+    ]
+    q.aggregate_batch(q.dissect_batch(q.decode_batch(later)))
+    assert q.metrics.datagrams_lost == 2
+    assert q.metrics.counter_discontinuities == 1
+    [agg] = q.flush_window()
+    assert agg.samples == 4
+
+
+def test_checkpoint_while_running(tmp_path):
+    path = str(tmp_path / "collector.ckp")
+    gen = synth.SflowGenerator(synth.SflowMix(seed=4, counters_ratio=0.3))
+    batches = [[(gen_data, None) for gen_data in gen.datagrams(20)] for _ in range(10)]
+    p = pipeline.Pipeline(
+        exporter=lambda window: None,
+        window=60.0,
+        checkpoint_path=path,
+        checkpoint_interval=0.01,
+    )
+    p.decode_shedder.high = p.dissect_shedder.high = 2.0  # never shed
+    p.start()
+    for batch in batches:
+        assert p.submit(batch)
+        p.checkpoint()
+    p.stop()
+
+    assert p.metrics.checkpoints > len(batches)
+    snap = checkpoint.read_snapshot(path)
+    assert snap.agent_sequences == dict(p.agent_sequences.items())
+    assert snap.if_counters == dict(p.if_counters.items())
+    assert snap.flows == []  # stop() exported the window
+    assert p.metrics.datagrams_lost == 0
+    assert len(snap.if_counters) > 0
+    assert all(isinstance(v, sflow.IfCounters) for v in snap.if_counters.values())
+
+
+def test_failed_checkpoints_are_counted_and_retried(tmp_path):
+    path = str(tmp_path / "collector.ckp")
+    pkt = eth_ipv4_udp(b"\x0a\x00\x00\x02", b"\x0a\x00\x00\x03", 1234, 53)
+    p = pipeline.Pipeline(
+        exporter=lambda window: None,
+        window=60.0,
+        checkpoint_path=str(tmp_path / "missing" / "collector.ckp"),
+        checkpoint_interval=0.01,
+    )
+    p.start()
+    # a malformed key never reaches the flow table the snapshot is built from
+    bad = datagram([sampled_ipv4_flow_sample(1, 300, 1234, 53)], 1)
+    assert p.submit([(bad, None), (datagram([flow_sample(2, 10, 1000, pkt)], 2), None)])
+    while p.metrics.checkpoint_errors < 3:
+        p._stop.wait(0.01)
+    p.checkpoint_path = path  # the disk comes back
+    while not p.metrics.checkpoints:
+        p._stop.wait(0.01)
+    p.stop()  # does not raise
+
+    assert p.metrics.checkpoint_errors >= 3
+    assert p.metrics.checkpoints >= 2
+    assert checkpoint.read_snapshot(path).agent_sequences == {
+        (b"\x0a\x00\x00\x01", 0): 2
+    }
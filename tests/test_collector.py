@@ -0,0 +1,234 @@
+import os
+import random
+import resource
+import socket
+import threading
+import time
+
+from ipfix_parser import collector, ipfix, synth
+
+
+def messages(count, seed=2):
+    return list(synth.IpfixGenerator(synth.IpfixMix(seed=seed)).messages(count))
+
+
+def test_stream_buffer_frames_across_the_wrap_without_copying():
+    msgs = messages(200)
+    stream = b"".join(msgs)
+    buf = collector.StreamBuffer(capacity=4096)
+    rng = random.Random(1)
+    framed = []
+    pos = 0
+    while pos < len(stream) or len(buf):
+        region = buf.writable()
+        n = min(len(region), rng.randint(1, 3000), len(stream) - pos)
+        region[:n] = stream[pos : pos + n]
+        pos += n
+        buf.tail += n
+        assert buf.tail <= len(buf.buf)
+        while True:
+            frame = buf.next_frame()
+            if frame is None:
+                break
+            assert frame.obj is buf.buf  # a view into the buffer itself
+            framed.append(bytes(frame))
+    assert framed == msgs
+    # messages did run past `capacity` into the slack
+    assert max(len(m) for m in msgs) < 4096 < len(stream)
+
+
+class Gate:
+    """Sink that refuses everything while closed."""
+
+    def __init__(self):
+        self.open = True
+        self.received = []
+
+    def __call__(self, exporter, msg):
+        if not self.open:
+            return False
+        self.received.append((exporter, msg))
+        return True
+
+
+def serve(col):
+    stop = threading.Event()
+    t = threading.Thread(target=col.serve, args=(stop,), daemon=True)
+    t.start()
+    return stop, t
+
+
+def test_tcp_and_udp_share_the_decode_path():
+    sink = Gate()
+    col = collector.IpfixCollector(sink, buffer_size=8192)
+    tcp_addr = col.listen_tcp("127.0.0.1", 0)
+    udp_addr = col.listen_udp("127.0.0.1", 0)
+    stop, t = serve(col)
+
+    msgs = messages(100)
+    clients = [socket.create_connection(tcp_addr) for _ in range(4)]
+    for client in clients:
+        client.sendall(b"".join(msgs))
+    udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    for data in msgs[:10]:
+        udp.sendto(data, udp_addr)
+    expected = 4 * len(msgs) + 10
+    deadline = time.monotonic() + 5.0
+    while len(sink.received) < expected and time.monotonic() < deadline:
+        time.sleep(0.01)
+    # session templates stay on their connections, out of checkpoints
+    assert list(col.template_caches) == ["udp:127.0.0.1"]
+    for client in clients:
+        client.close()
+    while time.monotonic() < deadline:
+        if len(sink.received) >= expected and not col.connections:
+            break
+        time.sleep(0.01)
+    stop.set()
+    t.join()
+    col.close()
+    udp.close()
+
+    assert len(sink.received) == expected
+    m = col.metrics
+    assert m.decode_errors == m.framing_errors == m.truncated_streams == 0
+    assert m.connections_accepted == m.connections_closed == 4
+    by_exporter = {}
+    for exporter, msg in sink.received:
+        by_exporter.setdefault(exporter, []).append(msg)
+    assert sorted(len(v) for v in by_exporter.values()) == [10, 100, 100, 100, 100]
+    for msgs_seen in by_exporter.values():
+        assert all(msg.unknown_sets == 0 for msg in msgs_seen)
+    assert list(col.template_caches) == ["udp:127.0.0.1"]
+
+
+def test_refused_messages_pause_the_connection():
+    sink = Gate()
+    col = collector.IpfixCollector(sink, buffer_size=4096)
+    addr = col.listen_tcp("127.0.0.1", 0)
+    # more than loopback socket buffers can absorb
+    msgs = messages(500) * 20
+    stream = memoryview(b"".join(msgs))
+    client = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    client.setsockopt(socket.SOL_SOCKET, socket.SO_SNDBUF, 64 << 10)
+    client.connect(addr)
+    client.setblocking(False)
+
+    sink.open = False
+    sent = 0
+    for _ in range(200):
+        try:
+            sent += client.send(stream[sent:])
+        except BlockingIOError:
+            pass
+        col.poll(0.001)
+    # the collector holds at most one buffer per connection; the rest
+    # stays in the socket buffers and the sender is pushed back
+    assert col.metrics.connections_paused == 1
+    assert sent < len(stream)
+    [conn] = col.connections.values()
+    assert len(conn.buffer) <= len(conn.buffer.buf)
+
+    sink.open = True
+    client.setblocking(True)
+    sender = threading.Thread(target=client.sendall, args=(stream[sent:],))
+    sender.start()
+    while len(sink.received) < len(msgs):
+        col.poll(0.01)
+    sender.join()
+    client.close()
+    col.close()
+    assert [msg.header.sequence_number for _, msg in sink.received] == [
+        ipfix.decode_message_header(data).sequence_number for data in msgs
+    ]
+
+
+def test_udp_templates_survive_a_restart(tmp_path):
+    path = str(tmp_path / "collector.ckp")
+    msgs = messages(40)
+    sink = Gate()
+    col = collector.IpfixCollector(sink, checkpoint_path=path, checkpoint_interval=0)
+    addr = col.listen_udp("127.0.0.1", 0)
+    udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    for data in msgs[:20]:
+        udp.sendto(data, addr)
+    stop = threading.Event()
+    t = threading.Thread(target=col.serve, args=(stop,), daemon=True)
+    t.start()
+    deadline = time.monotonic() + 5.0
+    while len(sink.received) < 20 and time.monotonic() < deadline:
+        time.sleep(0.01)
+    stop.set()
+    t.join()
+    col.close()
+    udp.close()
+    assert col.metrics.checkpoints > 0  # written by serve() on its own
+
+    restarted = collector.IpfixCollector(sink)
+    restarted.restore(path)
+    [cache] = restarted.template_caches.values()
+    assert cache.templates == col.template_caches["udp:127.0.0.1"].templates
+    # later data sets decode without waiting for a template refresh
+    later = msgs[20:]
+    assert any(
+        ipfix.decode_message(d, ipfix.TemplateCache()).unknown_sets for d in later
+    )
+    assert all(ipfix.decode_message(d, cache).unknown_sets == 0 for d in later)
+
+
+def test_running_out_of_descriptors_backs_off_accepting():
+    col = collector.IpfixCollector(Gate())
+    col.accept_backoff = 0.05
+    addr = col.listen_tcp("127.0.0.1", 0)
+    # connected through the backlog, waiting to be accepted
+    clients = [socket.create_connection(addr) for _ in range(20)]
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    resource.setrlimit(
+        resource.RLIMIT_NOFILE, (len(os.listdir("/proc/self/fd")) + 4, hard)
+    )
+    try:
+        for _ in range(20):
+            col.poll(0.01)  # does not raise
+        assert col.metrics.accept_pauses > 0
+        assert col.metrics.connections_accepted < len(clients)
+    finally:
+        resource.setrlimit(resource.RLIMIT_NOFILE, (soft, hard))
+    deadline = time.monotonic() + 5.0
+    while col.metrics.connections_accepted < len(clients):
+        assert time.monotonic() < deadline
+        col.poll(0.01)
+    msgs = messages(5)
+    for client in clients:
+        client.sendall(b"".join(msgs))
+    while len(col.sink.received) < len(clients) * len(msgs):
+        assert time.monotonic() < deadline
+        col.poll(0.01)
+    for client in clients:
+        client.close()
+    col.close()
+
+
+def test_failed_checkpoint_writes_are_counted_and_retried(tmp_path):
+    path = tmp_path / "state" / "collector.ckp"
+    col = collector.IpfixCollector(
+        Gate(), checkpoint_path=str(path), checkpoint_interval=0
+    )
+    addr = col.listen_udp("127.0.0.1", 0)
+    udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    for data in messages(5):
+        udp.sendto(data, addr)
+    stop, t = serve(col)
+    deadline = time.monotonic() + 5.0
+    while col.metrics.checkpoint_errors == 0:
+        assert time.monotonic() < deadline
+        time.sleep(0.01)
+    path.parent.mkdir()  # the disk comes back
+    while col.metrics.checkpoints == 0:
+        assert time.monotonic() < deadline
+        time.sleep(0.01)
+    stop.set()
+    t.join()
+    col.close()
+    udp.close()
+    assert len(col.sink.received) == 5
+    assert path.exists()
@@ -0,0 +1,129 @@
+from ipfix_parser import pipeline, sflow
+from tests.test_sflow import counters_sample, datagram, eth_ipv4_udp, flow_sample
+
+
+def samples(n: int, rate: int = 100):
+    pkt = eth_ipv4_udp(b"\x0a\x00\x00\x02", b"\x0a\x00\x00\x03", 1234, 53)
+    dgram = sflow.decode_datagram(
+        datagram([flow_sample(i, rate, 1000, pkt) for i in range(n)])
+    )
+    return [pipeline.AgentSample(dgram.agent_address, s) for s in dgram.samples]
+
+
+def test_ring_is_bounded():
+    ring = pipeline.Ring(2)
+    assert ring.try_push([1])
+    assert ring.try_push([2])
+    assert not ring.try_push([3])
+    assert ring.try_pop() == [1]
+    assert ring.try_push([3])
+    assert ring.high_water == 2
+
+
+def test_shedding_keeps_estimates_unbiased():
+    shedder = pipeline.LoadShedder(seed=1)
+    shedder.update(1.0)
+    shedder.update(1.0)
+    assert shedder.factor == 4
+
+    items = samples(4000)
+    kept, shed = shedder.apply(items)
+    assert len(kept) + shed == 4000
+    assert all(i.sample.sampling_rate == 400 for i in kept)
+    # 1000 expected, binomial sd ~27
+    assert abs(sum(i.sample.sampling_rate for i in kept) - 4000 * 100) < 4000 * 10
+
+    shedder.update(0.0)
+    assert shedder.factor == 2
+
+
+def test_pipeline_aggregates_and_reports_shedding():
+    windows = []
+    p = pipeline.Pipeline(exporter=windows.append, window=60.0, seed=1)
+    p.decode_shedder.factor = 2
+    pkt = eth_ipv4_udp(b"\x0a\x00\x00\x02", b"\x0a\x00\x00\x03", 1234, 53)
+    batch = [
+        (datagram([flow_sample(i, 10, 1000, pkt) for i in range(8)], seq), None)
+        for seq in range(4)
+    ]
+    # keep the decoded ring low so the shedder does not back off to 1
+    p.decode_shedder.low = -1.0
+    p.start()
+    assert p.submit(batch)
+    p.stop()
+
+    flows = [agg for window in windows for agg in window]
+    assert len(flows) == 1
+    kept = flows[0].samples
+    assert 0 < kept < 32
+    assert flows[0].packets == kept * 2 * 10
+    assert flows[0].bytes == kept * 2 * 10 * 1000
+
+    metrics = p.metrics.snapshot()
+    assert metrics["flow_samples"] == 32
+    assert metrics["samples_shed"] == 32 - kept
+    assert metrics["flows_exported"] == 1
+
+
+def test_backed_up_decoder_is_shed_by_datagram_keeping_counters():
+    windows = []
+    counters = []
+    p = pipeline.Pipeline(
+        exporter=windows.append, counters_sink=counters.extend, seed=1
+    )
+    # as if the raw ring were backed up
+    p.raw_shedder.factor = 4
+    p.raw_shedder.low = -1.0
+    pkt = eth_ipv4_udp(b"\x0a\x00\x00\x02", b"\x0a\x00\x00\x03", 1234, 53)
+    batch = [
+        (
+            datagram(
+                [flow_sample(i, 10, 1000, pkt) for i in range(4)]
+                + [counters_sample(seq, 1000 * seq)],
+                seq,
+            ),
+            None,
+        )
+        for seq in range(8)
+    ]
+    p.start()
+    assert p.submit(batch)
+    p.stop()
+
+    metrics = p.metrics.snapshot()
+    shed = metrics["datagrams_shed"]
+    assert 0 < shed < 8
+    [flow] = [agg for window in windows for agg in window]
+    assert flow.samples == (8 - shed) * 4
+    assert flow.packets == flow.samples * 4 * 10
+    # every counter sample survives, and no datagram reads as lost
+    assert len(counters) == 8
+    assert metrics["samples_shed"] == shed * 4
+    assert metrics["datagrams_lost"] == metrics["datagrams_dropped"] == 0
+
+
+def test_interleaved_agents_are_each_estimated_without_bias():
+    windows = []
+    p = pipeline.Pipeline(exporter=windows.append, seed=3)
+    p.raw_shedder.factor = 2
+    p.raw_shedder.low = -1.0
+    p.raw_shedder.high = 2.0
+    pkt = eth_ipv4_udp(b"\x0a\x00\x00\x02", b"\x0a\x00\x00\x03", 1234, 53)
+    agents = (b"\x0a\x00\x00\x01", b"\x0a\x00\x00\x02")
+    batch = [
+        (datagram([flow_sample(seq, 10, 1000, pkt)], seq, agent), None)
+        for seq in range(200)
+        for agent in agents
+    ]
+    p.start()
+    for i in range(0, len(batch), 50):
+        assert p.submit(batch[i : i + 50])
+    p.stop()
+
+    packets = dict.fromkeys(agents, 0)
+    for window in windows:
+        for agg in window:
+            packets[agg.agent_address] += agg.packets
+    # 200 samples of rate 10 each; a kept sample counts 20, sd ~140
+    for agent in agents:
+        assert abs(packets[agent] - 2000) < 500, packets
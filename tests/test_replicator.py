@@ -0,0 +1,147 @@
+import socket
+
+import pytest
+
+from ipfix_parser import pipeline, replicator, sflow
+from tests.test_sflow import counters_sample, datagram, eth_ipv4_udp, flow_sample
+
+
+def listener():
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("127.0.0.1", 0))
+    sock.settimeout(1.0)
+    return sock
+
+
+def drain(sock):
+    got = []
+    sock.setblocking(False)
+    try:
+        while True:
+            got.append(sock.recv(0xFFFF))
+    except BlockingIOError:
+        return got
+
+
+@pytest.mark.parametrize("use_sendmmsg", [True, False])
+def test_forwards_untouched_with_per_target_filters(use_sendmmsg):
+    pkt = eth_ipv4_udp(b"\x0a\x00\x00\x02", b"\x0a\x00\x00\x03", 1234, 53)
+    flows = datagram([flow_sample(1, 10, 100, pkt)], agent=b"\x0a\x00\x00\x01")
+    counters = datagram([counters_sample(1, 5)], agent=b"\x0a\x00\x00\x09")
+
+    everything, only_agent, only_counters = listener(), listener(), listener()
+    targets = [
+        replicator.ReplicationTarget(everything.getsockname()),
+        replicator.ReplicationTarget(
+            only_agent.getsockname(),
+            replicator.TargetFilter.create(agents=["10.0.0.9"]),
+        ),
+        replicator.ReplicationTarget(
+            only_counters.getsockname(),
+            replicator.TargetFilter.create(sample_formats=[sflow.SAMPLE_COUNTERS]),
+        ),
+    ]
+    rep = replicator.Replicator(targets)
+    rep.use_sendmmsg = use_sendmmsg and replicator._sendmmsg is not None
+    rep.open()
+    p = pipeline.Pipeline(exporter=lambda window: None, ring_capacity=1, replicator=rep)
+    # replication happens before the raw ring, so a full ring drops the
+    # batch for the decoder only
+    assert p.raw_ring.try_push(([], None))
+    assert not p.submit([(flows, None), (counters, None), (b"garbage", None)])
+    rep.close()
+
+    assert everything.recv(0xFFFF) == flows
+    assert drain(everything) == [counters, b"garbage"]
+    assert drain(only_agent) == [counters]
+    assert drain(only_counters) == [counters]
+
+    stats = rep.stats()
+    assert stats[targets[0].name]["forwarded"] == 3
+    assert stats[targets[1].name]["filtered"] == 2
+    assert stats[targets[2].name]["forwarded_bytes"] == len(counters)
+    for sock in (everything, only_agent, only_counters):
+        sock.close()
+
+
+def test_source_id_filter():
+    pkt = eth_ipv4_udp(b"\x0a\x00\x00\x02", b"\x0a\x00\x00\x03", 1234, 53)
+    data = datagram([flow_sample(1, 10, 100, pkt), counters_sample(2, 5)])
+    summary = replicator.summarize(data)
+    assert summary.source_ids == {
+        s.source_id for s in sflow.decode_datagram(data).samples
+    }
+    assert replicator.TargetFilter.create(source_ids=[3]).matches(summary)
+    assert not replicator.TargetFilter.create(source_ids=[4]).matches(summary)
+    assert replicator.summarize(data[:-4]) is None
+
+
+def test_sample_and_record_formats_are_separate():
+    pkt = eth_ipv4_udp(b"\x0a\x00\x00\x02", b"\x0a\x00\x00\x03", 1234, 53)
+    flows = replicator.summarize(datagram([flow_sample(1, 10, 100, pkt)]))
+    counters = replicator.summarize(datagram([counters_sample(1, 5)]))
+    # a flow sample and an if_counters record are both format 1
+    flow_samples = replicator.TargetFilter.create(sample_formats=[sflow.SAMPLE_FLOW])
+    assert flow_samples.matches(flows)
+    assert not flow_samples.matches(counters)
+    if_counters = replicator.TargetFilter.create(record_formats=[sflow.COUNTERS_IF])
+    assert if_counters.matches(counters)
+    assert if_counters.matches(flows)  # FLOW_SAMPLED_HEADER is 1 too
+    switch = replicator.TargetFilter.create(record_formats=[sflow.FLOW_EXT_SWITCH])
+    assert switch.matches(flows)
+    assert not switch.matches(counters)
+
+
+def test_parse_target():
+    target = replicator.parse_target(
+        "10.0.0.7:6343,agent=192.0.2.1,agent=192.0.2.2,sample_format=2"
+    )
+    assert target.address == ("10.0.0.7", 6343)
+    assert target.filter == replicator.TargetFilter.create(
+        agents=["192.0.2.1", "192.0.2.2"], sample_formats=[2]
+    )
+    assert replicator.parse_target("[::1]:6343").address == ("::1", 6343)
+    assert replicator.parse_target("[::1]:6343").filter is None
+    with pytest.raises(ValueError):
+        replicator.parse_target("10.0.0.7:6343,data_format=1")
+
+
+def test_decoder_continues_from_the_filter_parse(monkeypatch):
+    pkt = eth_ipv4_udp(b"\x0a\x00\x00\x02", b"\x0a\x00\x00\x03", 1234, 53)
+    batch = [
+        (datagram([flow_sample(seq, 10, 100, pkt), counters_sample(seq, 5)], seq), None)
+        for seq in range(1, 9)
+    ]
+    batch.append((b"garbage", None))
+    sink = listener()
+    target = replicator.ReplicationTarget(
+        sink.getsockname(),
+        replicator.TargetFilter.create(sample_formats=[sflow.SAMPLE_COUNTERS]),
+    )
+    rep = replicator.Replicator([target])
+    rep.open()
+    windows = []
+    p = pipeline.Pipeline(exporter=windows.append, replicator=rep)
+
+    headers = []
+    decode_header = sflow.decode_header
+
+    def counting(data):
+        headers.append(data)
+        return decode_header(data)
+
+    monkeypatch.setattr(sflow, "decode_header", counting)
+    p.start()
+    assert p.submit(batch)
+    p.stop()
+    rep.close()
+
+    # each header is read once, by the filter; only garbage is retried
+    assert headers.count(b"garbage") == 2
+    assert len(headers) == len(batch) + 1
+    assert len(drain(sink)) == 8
+    sink.close()
+    [flow] = [agg for window in windows for agg in window]
+    assert flow.samples == 8
+    assert p.metrics.counter_samples == 8
+    assert p.metrics.decode_errors == 1
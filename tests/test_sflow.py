@@ -0,0 +1,103 @@
+import struct
+
+from ipfix_parser import dissect, sflow
+
+
+def xdr_opaque(data: bytes) -> bytes:
+    return struct.pack("!I", len(data)) + data + b"\0" * (-len(data) % 4)
+
+
+def record(fmt: int, data: bytes) -> bytes:
+    return struct.pack("!I", fmt) + xdr_opaque(data)
+
+
+def eth_ipv4_udp(src: bytes, dst: bytes, sport: int, dport: int) -> bytes:
+    eth = b"\x02" * 6 + b"\x04" * 6 + b"\x81\x00" + struct.pack("!H", 42)
+    eth += b"\x08\x00"
+    ip = struct.pack("!BBHHHBBH4s4s", 0x45, 0, 28, 0, 0, 64, 17, 0, src, dst)
+    return eth + ip + struct.pack("!HHHH", sport, dport, 8, 0)
+
+
+def flow_sample(seq: int, rate: int, frame_length: int, header: bytes) -> bytes:
+    hdr = struct.pack("!III", sflow.HDR_PROTO_ETHERNET, frame_length, 4)
+    records = record(sflow.FLOW_SAMPLED_HEADER, hdr + xdr_opaque(header))
+    records += record(sflow.FLOW_EXT_SWITCH, struct.pack("!IIII", 42, 0, 43, 0))
+    body = struct.pack("!IIIIIIII", seq, 3, rate, seq * rate, 0, 3, 7, 2)
+    return record(sflow.SAMPLE_FLOW, body + records)
+
+
+def sampled_ipv4_flow_sample(
+    seq: int, protocol: int, sport: int, dport: int, tos: int = 0
+) -> bytes:
+    ipv4 = struct.pack(
+        "!II4s4sIIII", 1000, protocol, b"\x0a\x00\x00\x02",
+        b"\x0a\x00\x00\x03", sport, dport, 0, tos,
+    )
+    body = struct.pack("!IIIIIIII", seq, 3, 10, seq * 10, 0, 3, 7, 1)
+    return record(sflow.SAMPLE_FLOW, body + record(sflow.FLOW_SAMPLED_IPV4, ipv4))
+
+
+def counters_sample(seq: int, in_octets: int) -> bytes:
+    values = [3, 6, 10**9, 1, 3, in_octets] + [0] * 6 + [in_octets // 2] + [0] * 6
+    ifc = struct.pack("!IIQIIQIIIIIIQIIIIII", *values)
+    body = struct.pack("!II", seq, 3) + struct.pack("!I", 1)
+    return record(sflow.SAMPLE_COUNTERS, body + record(sflow.COUNTERS_IF, ifc))
+
+
+def datagram(samples, seq: int = 1, agent: bytes = b"\x0a\x00\x00\x01") -> bytes:
+    hdr = struct.pack("!II", 5, sflow.ADDRESS_IP_V4) + agent
+    hdr += struct.pack("!IIII", 0, seq, 1000, len(samples))
+    return hdr + b"".join(samples)
+
+
+def test_decode_flow_and_counters():
+    pkt = eth_ipv4_udp(b"\x0a\x00\x00\x02", b"\x0a\x00\x00\x03", 1234, 53)
+    data = datagram([flow_sample(1, 512, 1500, pkt), counters_sample(1, 9000)])
+    dgram = sflow.decode_datagram(data)
+    assert dgram.agent_address == b"\x0a\x00\x00\x01"
+    assert dgram.sample_count == 2
+
+    flow, counters = dgram.samples
+    assert flow.sampling_rate == 512
+    assert flow.record(sflow.FLOW_SAMPLED_HEADER).header == pkt
+    assert flow.record(sflow.FLOW_EXT_SWITCH).dst_vlan == 43
+    assert counters.record(sflow.COUNTERS_IF).in_octets == 9000
+
+    key = dissect.dissect_flow_sample(flow)
+    assert key.vlan == 42
+    assert key.protocol == dissect.IPPROTO_UDP
+    assert (key.src_port, key.dst_port) == (1234, 53)
+
+
+def test_out_of_range_sampled_ipv4_is_not_a_flow_key():
+    data = datagram(
+        [
+            sampled_ipv4_flow_sample(1, 300, 1234, 53),
+            sampled_ipv4_flow_sample(2, 17, 1 << 16, 53),
+            sampled_ipv4_flow_sample(3, 17, 1234, 53, tos=0x1B8),
+        ]
+    )
+    bad_proto, bad_port, ok = sflow.decode_datagram(data).samples
+    assert dissect.dissect_flow_sample(bad_proto) is None
+    assert dissect.dissect_flow_sample(bad_port) is None
+    key = dissect.dissect_flow_sample(ok)
+    assert (key.protocol, key.src_port, key.dst_port, key.tos) == (17, 1234, 53, 0xB8)
+
+
+def test_unknown_records_are_kept_raw():
+    body = struct.pack("!IIIIIIII", 1, 3, 1, 1, 0, 3, 7, 1)
+    body += record((9 << 12) | 1, b"vendor")
+    dgram = sflow.decode_datagram(datagram([record(sflow.SAMPLE_FLOW, body)]))
+    rec = dgram.samples[0].records[0]
+    assert rec.enterprise == 9
+    assert rec.data == b"vendor"
+
+
+def test_truncated_datagram_raises():
+    data = datagram([counters_sample(1, 9000)])
+    try:
+        sflow.decode_datagram(data[:-8])
+    except sflow.DecodeError:
+        pass
+    else:
+        raise AssertionError("expected DecodeError")
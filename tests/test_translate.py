@@ -0,0 +1,150 @@
+import socket
+import time
+
+from ipfix_parser import ipfix, pipeline, sflow, synth, translate
+from tests.test_sflow import datagram, sampled_ipv4_flow_sample
+
+
+class Collect:
+    def __init__(self):
+        self.messages = []
+
+    def __call__(self, segments):
+        self.messages.append(b"".join(bytes(s) for s in segments))
+
+
+def agent_samples(count, **mix):
+    gen = synth.SflowGenerator(synth.SflowMix(seed=5, **mix))
+    items = []
+    for data in gen.datagrams(count):
+        dgram = sflow.decode_datagram(data)
+        items += [pipeline.AgentSample(dgram.agent_address, s) for s in dgram.samples]
+    return items
+
+
+def test_translated_messages_decode_and_fit_mtu():
+    sink = Collect()
+    tr = translate.IpfixTranslator(sink, domain_id=7, mtu=1500, clock=lambda: 1000.0)
+    items = agent_samples(50, counters_ratio=0.3, ipv6_agents=0.5)
+    tr.translate(items)
+    tr.flush()
+
+    assert len(sink.messages) > 1
+    cache = ipfix.TemplateCache()
+    records = []
+    expected_seq = 0
+    for data in sink.messages:
+        assert len(data) <= 1500 - translate.TRANSPORT_OVERHEAD
+        msg = ipfix.decode_message(data, cache)
+        assert msg.header.domain_id == 7
+        assert msg.header.sequence_number == expected_seq
+        assert msg.unknown_sets == 0
+        expected_seq += len(msg.records)
+        records += msg.records
+    # templates go out once, then only after the refresh interval
+    assert tr.stats.template_sets == 1
+    assert len(records) == tr.stats.flow_records + tr.stats.counter_records
+
+    flows = [i for i in items if isinstance(i.sample, sflow.FlowSample)]
+    v4 = [r for r in records if r.template.template_id in (256, 257)]
+    first_v4 = next(
+        i
+        for i in flows
+        if translate.dissect.dissect_flow_sample(i.sample).ethertype == 0x0800
+    )
+    values = dict(zip((f.ie for f in v4[0].template.fields), v4[0].values))
+    assert values[ipfix.IE_PACKET_DELTA_COUNT] == first_v4.sample.sampling_rate
+    assert values[translate.IE_OBSERVATION_TIME_MILLISECONDS] == 1_000_000
+
+
+def test_template_refresh():
+    sink = Collect()
+    now = [0.0]
+    tr = translate.IpfixTranslator(sink, template_refresh=10, clock=lambda: now[0])
+    items = agent_samples(2)
+    for step in range(3):
+        tr.translate(items)
+        tr.flush()
+        now[0] += 6
+    assert tr.stats.template_sets == 2
+
+
+def test_partial_messages_leave_after_max_delay():
+    sink = Collect()
+    now = [0.0]
+    tr = translate.IpfixTranslator(sink, clock=lambda: now[0], max_delay=0.5)
+    tr.translate(agent_samples(1)[:1])
+    now[0] += 0.4
+    tr.poll()
+    assert not sink.messages
+    now[0] += 0.1
+    tr.poll()
+    assert len(sink.messages) == 1
+    tr.poll()
+    assert len(sink.messages) == 1
+
+
+def test_send_errors_are_counted_and_translation_continues():
+    closed = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    closed.bind(("127.0.0.1", 0))
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.connect(closed.getsockname())
+    closed.close()  # port unreachable: later sends fail with ECONNREFUSED
+    tr = translate.IpfixTranslator(translate.socket_sink(sock))
+    items = agent_samples(2)
+    for _ in range(5):
+        tr.translate(items)
+        tr.flush()
+        time.sleep(0.01)
+    sock.close()
+    assert tr.stats.send_errors > 0
+    # lost records still advance the sequence number
+    assert tr.sequence_number == tr.stats.flow_records + tr.stats.counter_records
+
+
+def test_malformed_sampled_ipv4_is_skipped_not_fatal():
+    sink = Collect()
+    tr = translate.IpfixTranslator(sink, clock=lambda: 1000.0)
+    p = pipeline.Pipeline(exporter=lambda window: None, translator=tr)
+    data = datagram(
+        [sampled_ipv4_flow_sample(1, 300, 1234, 53)]
+        + [sampled_ipv4_flow_sample(2, 17, 1234, 53)]
+    )
+    p.start()
+    assert p.submit([(data, None)])
+    p.stop()
+    assert tr.stats.flow_records == 1
+    assert tr.stats.skipped_samples == 1
+    assert p.metrics.flows_exported == 1
+
+
+def test_if_counters_are_one_record_per_direction_with_wrapping_packets():
+    def counters(in_ucast, out_octets):
+        head = [7, 6, 10**9, 1, 3]
+        ingress = [5000, in_ucast, 10, 2, 4, 0, 0]
+        egress = [out_octets, 300, 20, 1, 9, 0, 0]
+        ifc = sflow.IfCounters(*head, *ingress, *egress)
+        sample = sflow.CountersSample(1, 7, [sflow.Record(sflow.COUNTERS_IF, ifc)])
+        return pipeline.AgentSample(b"\x0a\x00\x00\x01", sample)
+
+    sink = Collect()
+    tr = translate.IpfixTranslator(sink, clock=lambda: 1000.0)
+    # in_ucast_pkts wraps between the two polls; the others keep counting
+    tr.translate([counters(0xFFFFFFF0, 7000), counters(0x10, 9000)])
+    tr.flush()
+    [data] = sink.messages
+    msg = ipfix.decode_message(data, ipfix.TemplateCache())
+    rows = [dict(zip((f.ie for f in r.template.fields), r.values)) for r in msg.records]
+    ingress = [r for r in rows if r[translate.IE_FLOW_DIRECTION] == 0]
+    egress = [r for r in rows if r[translate.IE_FLOW_DIRECTION] == 1]
+    assert tr.stats.counter_records == len(rows) == 4
+
+    assert all(r[ipfix.IE_INGRESS_INTERFACE] == 7 for r in ingress)
+    assert all(r[ipfix.IE_EGRESS_INTERFACE] == 7 for r in egress)
+    assert all(ipfix.IE_INGRESS_INTERFACE not in r for r in egress)
+    assert [r[translate.IE_OCTET_TOTAL_COUNT] for r in egress] == [7000, 9000]
+    assert [r[translate.IE_DROPPED_PACKET_TOTAL_COUNT] for r in egress] == [9, 9]
+    assert [r[translate.IE_PACKET_TOTAL_COUNT] for r in egress] == [321, 321]
+    # the sum wraps at 2**32 too, so its delta modulo 2**32 is still right
+    first, second = (r[translate.IE_PACKET_TOTAL_COUNT] for r in ingress)
+    assert (second - first) % (1 << 32) == 0x20
@@ -0,0 +1,223 @@
+import errno
+import os
+
+from ipfix_parser import sflow, synth, tsstore
+
+
+def crash(store):
+    """Drop a store as a killed process would, without flushing."""
+    if store._map is not None:
+        store._map.close()
+    store._tail.close()
+    os.close(store._fd)
+    os.close(store._tail_fd)
+
+
+def fleet_rows(rounds, **mix):
+    fleet = synth.CounterFleet(synth.FleetMix(seed=9, **mix))
+    expected = {}
+    for ts, agent, sample in fleet.polls(rounds):
+        for rec in sample.records:
+            key = (agent, sample.source_id, rec.data_format)
+            expected.setdefault(key, []).append((ts, tuple(rec.data)))
+    return expected
+
+
+def test_fleet_roundtrip_survives_reopen(tmp_path):
+    path = str(tmp_path / "counters.tsb")
+    expected = fleet_rows(40, agents=3, interfaces_per_agent=4)
+    with tsstore.CounterStore(path, block_rows=16) as store:
+        for key, rows in expected.items():
+            for ts, values in rows:
+                store.append(key, ts, values)
+        # 40 rows per series: two full blocks written, the rest buffered
+        assert all(len(s.blocks) == 2 for s in store.series.values())
+        assert all(list(store.scan(k)) == rows for k, rows in expected.items())
+
+    with tsstore.CounterStore(path, block_rows=16) as store:
+        assert store.stats.rows == sum(len(rows) for rows in expected.values())
+        assert store.stats.compression_ratio > 4
+        for key, rows in expected.items():
+            assert list(store.scan(key)) == rows
+
+        key = next(k for k in expected if k[2] == sflow.COUNTERS_IF)
+        rows = expected[key]
+        start, end = rows[5][0], rows[30][0]
+        names = sflow.IfCounters._fields
+        octets = [names.index("in_octets"), names.index("out_octets")]
+        got = list(store.scan(key, start, end, fields=("in_octets", "out_octets")))
+        assert got == [
+            (ts, tuple(values[i] for i in octets)) for ts, values in rows[5:30]
+        ]
+
+
+def test_block_edge_cases(tmp_path):
+    path = str(tmp_path / "counters.tsb")
+    agent = b"\x20\x01\x0d\xb8" + bytes(12)
+    proc = (agent, 0, sflow.COUNTERS_PROCESSOR)
+    vlan = (agent, 7, sflow.COUNTERS_VLAN)
+    proc_rows = [(1000, (-1, 0, 5, 1 << 35, (1 << 64) - 1)), (900, (3, -7, 5, 0, 0))]
+    # a u32 counter wrapping and the largest possible u64 step
+    vlan_rows = [
+        (
+            t * 30_000,
+            (
+                7,
+                (1 << 64) - 1 if t % 2 else 0,
+                (0xFFFFFFF0 + t * 8) & 0xFFFFFFFF,
+                0,
+                0,
+                0,
+            ),
+        )
+        for t in range(5)
+    ]
+    with tsstore.CounterStore(path, block_rows=4) as store:
+        store.append((agent, 1, sflow.COUNTERS_IF), 5, tuple(range(19)))
+        for ts, values in proc_rows:
+            store.append(proc, ts, values)
+        for ts, values in vlan_rows:
+            store.append(vlan, ts, values)
+    size = os.path.getsize(path)
+    with open(path, "ab") as f:
+        f.write(tsstore.BLOCK_MAGIC + b"\x00\x00\xff\xff torn")
+
+    with tsstore.CounterStore(path, block_rows=4) as store:
+        assert list(store.scan((agent, 1, sflow.COUNTERS_IF))) == [
+            (5, tuple(range(19)))
+        ]
+        assert list(store.scan(proc)) == proc_rows
+        assert list(store.scan(vlan)) == vlan_rows
+        assert list(store.scan((agent, 2, sflow.COUNTERS_IF))) == []
+        assert store.stats.stored_bytes == size
+        # the torn bytes are gone, so blocks written now survive a reopen
+        assert os.path.getsize(path) == size
+        store.append(proc, 1100, (1, 2, 3, 4, 5))
+
+    with tsstore.CounterStore(path, block_rows=4) as store:
+        assert list(store.scan(proc)) == proc_rows + [(1100, (1, 2, 3, 4, 5))]
+
+
+def test_partial_blocks_are_written_by_age_and_memory_budget(tmp_path):
+    path = str(tmp_path / "counters.tsb")
+    expected = fleet_rows(30, agents=2, interfaces_per_agent=3)
+    polls = sorted(
+        (ts, key, values) for key, rows in expected.items() for ts, values in rows
+    )
+    store = tsstore.CounterStore(path, max_age_ms=120_000)
+    for ts, key, values in polls:
+        store.append(key, ts, values)
+    # a partial block waits at most max_age plus one sweep interval (1/8)
+    newest = polls[-1][0]
+    limit = 120_000 + 120_000 // 8
+    assert all(newest - s.first_ts <= limit for s in store.series.values() if s.buffer)
+    assert store.stats.blocks >= 4 * len(expected)
+
+    # without close(), as after a crash: the buffered rows are in the tail
+    crash(store)
+    with tsstore.CounterStore(path) as reopened:
+        assert reopened.stats.rows_recovered > 0
+        for key, rows in expected.items():
+            assert list(reopened.scan(key)) == rows
+    assert not os.path.exists(path + tsstore.TAIL_SUFFIX)
+
+    path = str(tmp_path / "budget.tsb")
+    with tsstore.CounterStore(path, max_age_ms=None, max_buffered=4096) as store:
+        for ts, key, values in polls:
+            store.append(key, ts, values)
+            assert store.buffered_bytes <= 4096
+        for key, rows in expected.items():
+            assert list(store.scan(key)) == rows
+
+
+def test_write_errors_keep_rows_buffered_until_the_disk_recovers(tmp_path, monkeypatch):
+    path = str(tmp_path / "counters.tsb")
+    expected = fleet_rows(30, agents=2, interfaces_per_agent=3)
+    polls = sorted(
+        (ts, key, values) for key, rows in expected.items() for ts, values in rows
+    )
+    store = tsstore.CounterStore(path, block_rows=8, max_age_ms=None)
+    write = os.write
+    full = [True]
+
+    def no_space(fd, data):
+        if fd == store._fd and full[0]:
+            raise OSError(errno.ENOSPC, "No space left on device")
+        return write(fd, data)
+
+    monkeypatch.setattr(os, "write", no_space)
+    half = len(polls) // 2
+    for ts, key, values in polls[:half]:
+        store.append(key, ts, values)  # never raises
+    assert store.stats.write_errors > 0
+    assert store.stats.blocks == 0 and os.path.getsize(path) == 0
+
+    full[0] = False
+    for ts, key, values in polls[half:]:
+        store.append(key, ts, values)
+    store.close()
+    assert store.stats.rows_dropped == 0
+    with tsstore.CounterStore(path) as reopened:
+        for key, rows in expected.items():
+            assert list(reopened.scan(key)) == rows
+        assert all(ref.rows <= 8 for s in reopened.series.values() for ref in s.blocks)
+
+
+def test_write_errors_are_bounded_by_the_memory_budget(tmp_path, monkeypatch):
+    path = str(tmp_path / "counters.tsb")
+    expected = fleet_rows(30, agents=2, interfaces_per_agent=3)
+    polls = sorted(
+        (ts, key, values) for key, rows in expected.items() for ts, values in rows
+    )
+
+    def no_space(fd, data):
+        raise OSError(errno.ENOSPC, "No space left on device")
+
+    monkeypatch.setattr(os, "write", no_space)
+    store = tsstore.CounterStore(path, max_age_ms=None, max_buffered=4096)
+    for ts, key, values in polls:
+        store.append(key, ts, values)
+        assert store.buffered_bytes <= 4096
+    assert store.stats.rows_dropped > 0
+    assert store.stats.write_errors > 0
+    store.close()
+
+
+def test_blocks_fill_at_defaults_and_survive_a_crash(tmp_path, monkeypatch):
+    path = str(tmp_path / "counters.tsb")
+    full = 2 * tsstore.BLOCK_ROWS
+    expected = fleet_rows(full + 10, agents=1, interfaces_per_agent=2)
+    polls = sorted(
+        (ts, key, values) for key, rows in expected.items() for ts, values in rows
+    )
+    # every series' first `full` rows, then the remaining ten of each
+    cut = {key: rows[full - 1][0] for key, rows in expected.items()}
+    first = [p for p in polls if p[0] <= cut[p[1]]]
+    rest = [p for p in polls if p[0] > cut[p[1]]]
+
+    store = tsstore.CounterStore(path)
+    # crash right after the last blocks are written, before their slots
+    # are emptied: those rows are in both files
+    mirror = store._mirror
+    monkeypatch.setattr(store, "_mirror", lambda s: s.buffer and mirror(s))
+    for ts, key, values in first:
+        store.append(key, ts, values)
+    crash(store)
+    reopened = tsstore.CounterStore(path)
+    blocks = [ref for s in reopened.series.values() for ref in s.blocks]
+    assert all(ref.rows == tsstore.BLOCK_ROWS for ref in blocks)
+    assert len(blocks) == 2 * len(expected)
+    assert reopened.stats.rows_recovered == 0
+    for key, rows in expected.items():
+        assert list(reopened.scan(key)) == rows[:full]
+    for ts, key, values in rest:
+        reopened.append(key, ts, values)
+    crash(reopened)
+
+    with tsstore.CounterStore(path) as reopened:
+        assert reopened.stats.rows_recovered == 10 * len(expected)
+        for key, rows in expected.items():
+            assert list(reopened.scan(key)) == rows
+    with tsstore.CounterStore(path) as reopened:
+        for key, rows in expected.items():
+            assert list(reopened.scan(key)) == rows